@@ -2,8 +2,14 @@
 // File: common_tools.cc
 // Contents: common functions that both tools will use
 // Classes:
+//   BackgroundTask
+//   MappedFile
+//   WriteFileAtomically
 //   MySQLInterface
+//   StatementBuilder
 //   BaseParser::ColumnAcquirer
+//   BaseParser::SchemaLoader
+//   BaseParser::Resolver
 //   BaseParser
 //   RecordsHolder
 // ************************************************************************* //
@@ -17,16 +23,126 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>	// For getenv
+#include <cstring>	// For memset
+#include <cstdio>	// For rename, remove
+#include <sstream>
+#include <sys/mman.h>	// For mmap, madvise
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>	// For close
 using namespace std;
 
 const char* const INSTALLATION_FOLDER = "---";
 const char* const CONFIGURATION_FOLDER = "./";
 
+// ===> BackgroundTask <===
+// A job run on a thread of its own
+// Entry of the thread
+void* BackgroundTask::Entry(void* task)
+{
+  // Each thread using MySQL shall be registered
+  ::mysql_thread_init();
+  static_cast<BackgroundTask*>(task)->Run();
+  ::mysql_thread_end();
+  return 0;
+}
+
+// Start the job
+void BackgroundTask::Start()
+{
+  if(running)
+    return;
+  if(pthread_create(&thread, 0, Entry, this))
+  {
+    cerr << "Warning... Can't create a thread, running in foreground..." << endl;
+    Run();
+    return;
+  }
+  running = true;
+}
+
+// Wait for the job
+void BackgroundTask::Join()
+{
+  if(!running)
+    return;
+  pthread_join(thread, 0);
+  running = false;
+}
+
+// ===> MappedFile <===
+// A file mapped into memory
+bool MappedFile::Open(const string& filename)
+{
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(-1 == fd)
+    return false;
+  struct stat status;
+  if(-1 == fstat(fd, &status) || !S_ISREG(status.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+  if(0 == status.st_size)
+  {
+    close(fd);
+    return true;
+  }
+
+  void* mapped = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);	// The mapping holds the file
+  if(MAP_FAILED == mapped)
+    return false;
+  // Pages ahead are read in advance, and those behind may be dropped
+  madvise(mapped, status.st_size, MADV_SEQUENTIAL);
+  data = static_cast<const char*>(mapped);
+  size = status.st_size;
+  return true;
+}
+
+// Unmap the file
+void MappedFile::Close()
+{
+  if(data)
+    munmap(const_cast<char*>(data), size);
+  data = 0;
+  size = 0;
+}
+
+// ===> WriteFileAtomically <===
+bool WriteFileAtomically(const string& name, const string& content)
+{
+  ostringstream temporary;
+  temporary << name << ".tmp." << getpid();
+  ofstream out(temporary.str().c_str());
+  if(out.is_open())
+  {
+    out.write(content.data(), content.size());
+    out.close();
+    if(!out.fail() && 0 == rename(temporary.str().c_str(), name.c_str()))
+      return true;
+  }
+  remove(temporary.str().c_str());
+  return false;
+}
+
+namespace {
+  // The MySQL library is initiated once before any thread is created, and
+  // ended after all connections are closed (not by each connection, since
+  // connections may live in different threads at the same time).
+  class MySQLLibrary {
+  public:
+    MySQLLibrary() { ::mysql_library_init(0, 0, 0); }
+    ~MySQLLibrary() { ::mysql_library_end(); }
+  } mysql_library;
+}
+
 // ===> MySQLInterface <===
 // MySQL interface. Handles all MySQL query
 // Constructor: initialize variables and connect to database
 MySQLInterface::MySQLInterface():
-    rows(-1), fields(-1),
+    rows(-1), fields(-1), max_packet(0), quiet(false),
     errorNum(0), errorInfo("ok"),
     result(0)
 {
@@ -142,11 +258,75 @@ bool MySQLInterface::GetDataFromDB(const string& queryStr, vector<vector<string>
   return true;
 }
 
+// Streaming data retriever
+// Need two arguments:
+//   1. MySQL query
+//   2. receiver of each record (NULL column as empty string)
+// Returns true if nothing wrong
+bool MySQLInterface::StreamDataFromDB(const string& queryStr, RowReceiver& receiver)
+{
+  if(queryStr.empty())
+  {
+    cerr<<"No command to query."<<endl;
+    return false;
+  }
+  else if(!TestingQueryCommand(queryStr, "select"))
+  {
+    cerr << "Illegal query: command shall start with \"select\"." << endl;
+    return false;
+  }
+
+  if(::mysql_real_query(&mysqlInstance,queryStr.c_str(),queryStr.size()))
+  {
+    cerr<<"Query |\033[3m"<<queryStr<<"\033[0m| failed."<<endl;
+    this->errorIntoMySQL();
+    return false;
+  }
+
+  ClearData();
+  // Records stay on the server until fetched
+  result = ::mysql_use_result(&mysqlInstance);
+  if(!result)
+  {
+    cerr<<"No result retrieved from database."<<endl;
+    return false;
+  }
+  fields = ::mysql_num_fields(result);
+
+  rows = 0;
+  vector<string> linedata(fields);
+  MYSQL_ROW line;
+  while((line = ::mysql_fetch_row(result)))
+  {
+    unsigned long* lengths = ::mysql_fetch_lengths(result);
+    for(unsigned long i=0;i<fields;++i)
+    {
+      if(line[i])
+        linedata[i].assign(line[i], lengths[i]);
+      else
+        linedata[i].clear();
+    }
+    receiver(linedata);
+    ++rows;
+  }
+
+  // mysql_fetch_row also returns NULL if the connection breaks
+  if(::mysql_errno(&mysqlInstance))
+  {
+    cerr<<"Streaming stopped after "<<rows<<" rows."<<endl;
+    this->errorIntoMySQL();
+    return false;
+  }
+  return true;
+}
+
 // Error messages
 void MySQLInterface::errorIntoMySQL()
 {
   errorNum  = ::mysql_errno(&mysqlInstance);
   errorInfo = ::mysql_error(&mysqlInstance);
+  if(quiet)
+    return;
   cerr<<"\033[31mError INFO: "<<errorInfo<<"\033[0m"<<endl;
   cerr<<"\033[31mError code: "<<errorNum<<"\033[0m"<<endl;
 }
@@ -156,7 +336,6 @@ void MySQLInterface::closeMySQL()
 {
   ClearData();
   ::mysql_close(&mysqlInstance);
-  ::mysql_library_end();
 }
 
 // Displaying data from MySQL in MySQL's way
@@ -342,7 +521,8 @@ bool MySQLInterface::Non_Select_Query(const string& queryStr)
   int result = ::mysql_real_query(&mysqlInstance, queryStr.c_str(), queryStr.size());
   if(result)
   {
-    cerr << "Error code: " << result << endl;
+    if(!quiet)
+      cerr << "Error code: " << result << endl;
     return false;
   }
 
@@ -418,13 +598,171 @@ bool MySQLInterface::Delete(const string& queryStr)
   return Non_Select_Query(queryStr);
 }
 
+bool MySQLInterface::Replace(const string& queryStr)
+{
+  if(!TestingQueryCommand(queryStr, "replace"))
+  {
+    cerr << "Illegal query: command shall start with \"replace\"." << endl;
+    return false;
+  }
+
+  return Non_Select_Query(queryStr);
+}
+
 // Direct query. Should be used only when necessary
 bool MySQLInterface::DirectQuery(const string& queryStr)
 {
-  cerr << "Warning... Direct query (no result to fetch) called..." << endl;
+  if(!quiet)
+    cerr << "Warning... Direct query (no result to fetch) called..." << endl;
   return Non_Select_Query(queryStr);
 }
 
+// Create a temporary table
+// Need 2 arguments:
+//   1. name of the table
+//   2. definition of columns (with the parentheses)
+bool MySQLInterface::CreateTemporaryTable(const string& name, const string& definition)
+{
+  if(name.empty() || definition.empty())
+  {
+    cerr << "Incomplete temporary table |" << name << definition << "|..." << endl;
+    return false;
+  }
+
+  string command("create temporary table ");
+  command.append(name);
+  command.append(" ");
+  command.append(definition);
+  if(!Non_Select_Query(command))
+  {
+    errorIntoMySQL();
+    return false;
+  }
+  return true;
+}
+
+// Multi-row inserter
+// Need 3 arguments:
+//   1. leading words of the command, till "values "
+//   2. tuples of values, "(...)" each
+//   3. limit of the size of a command (0 to ask the server)
+// Returns true if all inserted
+bool MySQLInterface::BatchInsert(const string& head, const vector<string>& tuples, unsigned long packet_size)
+{
+  if(tuples.empty())
+    return true;
+  if(0 == packet_size)
+    packet_size = MaxAllowedPacket();
+
+  string command(head);
+  command.reserve(packet_size < (1ul<<24) ? packet_size : (1ul<<24));
+  size_t in_command = 0;	// Number of tuples in <command>
+  size_t N_tuples = tuples.size();
+  for(size_t i=0;i<N_tuples;++i)
+  {
+    if(in_command && command.size() + tuples[i].size() + 1 > packet_size)
+    {
+      if(!Insert(command))
+      {
+        errorIntoMySQL();
+        return false;
+      }
+      command.assign(head);
+      in_command = 0;
+    }
+    if(in_command)
+      command.append(",");
+    command.append(tuples[i]);
+    ++in_command;
+  }
+
+  if(!Insert(command))
+  {
+    errorIntoMySQL();
+    return false;
+  }
+  return true;
+}
+
+// Ask the server for max_allowed_packet. A margin is left for the protocol.
+unsigned long MySQLInterface::MaxAllowedPacket()
+{
+  if(max_packet)
+    return max_packet;
+
+  // Default of MySQL servers if the variable is unavailable
+  max_packet = 1ul << 20;
+  vector<vector<string> > data;
+  if(GetDataFromDB("select @@max_allowed_packet", data) &&
+     !data.empty() && !data[0].empty())
+  {
+    unsigned long from_server = strtoul(data[0][0].c_str(), 0, 10);
+    if(from_server > 4096)
+      max_packet = from_server;
+  }
+  ClearData();
+  max_packet -= 1024;
+  return max_packet;
+}
+
+// Escape a string using the character set of the connection
+string MySQLInterface::Escape(const string& value)
+{
+  if(value.empty())
+    return value;
+
+  vector<char> buffer(value.size() * 2 + 1);
+  unsigned long length = ::mysql_real_escape_string(&mysqlInstance, &buffer[0], value.c_str(), value.size());
+  return string(&buffer[0], length);
+}
+
+// Escape a string to the end of <target>
+void MySQLInterface::AppendEscaped(string& target, const string& value)
+{
+  if(value.empty())
+    return;
+
+  size_t old_size = target.size();
+  target.resize(old_size + value.size() * 2 + 1);
+  unsigned long length = ::mysql_real_escape_string(&mysqlInstance, &target[old_size], value.c_str(), value.size());
+  target.resize(old_size + length);
+}
+
+
+// ===> StatementBuilder <===
+// Writer of query commands
+// A quoted value
+StatementBuilder& StatementBuilder::Value(const string& value)
+{
+  buffer.push_back('\'');
+  if("true" == value)
+    buffer.push_back('1');
+  else if("false" == value)
+    buffer.push_back('0');
+  else if(connection)
+    connection->AppendEscaped(buffer, value);
+  else
+  {
+    // The same characters as mysql_real_escape_string
+    for(size_t i=0;i<value.size();++i)
+    {
+      switch(value[i])
+      {
+        case '\0':   buffer.append("\\0"); break;
+        case '\n':   buffer.append("\\n"); break;
+        case '\r':   buffer.append("\\r"); break;
+        case '\032': buffer.append("\\Z"); break;
+        case '\\':   buffer.append("\\\\"); break;
+        case '\'':   buffer.append("\\'"); break;
+        case '"':    buffer.append("\\\""); break;
+        default:     buffer.push_back(value[i]);
+      }
+    }
+  }
+  buffer.push_back('\'');
+  return *this;
+}
+
 
 // ===> BaseParser::ColumnAcquirer <===
 // Prepare the structure of table for BaseParser
@@ -433,6 +771,7 @@ BaseParser::ColumnAcquirer::ColumnAcquirer()
 {
   names.reserve(32);
   levels.reserve(16);
+  keys.reserve(16);
 }
 
 // Retrieve the structure of the target table from database
@@ -479,6 +818,7 @@ bool BaseParser::ColumnAcquirer::Acquire(const string& server, const string& dat
 
   size_t s = data.size();
   names.resize(s*2);
+  keys.resize(s);
   // [0] - [s-1]: the name of columns
   // [s] - [s+s-1]: the type of the columns
   map<string, size_t> index_of_column;
@@ -486,8 +826,9 @@ bool BaseParser::ColumnAcquirer::Acquire(const string& server, const string& dat
   {
     names[i].assign(data[i][0]);
     names[i+s].assign(data[i][1]);
-    data[i].clear();
+    keys[i].assign(data[i][3]);
     index_of_column.insert(make_pair(data[i][0], i));
+    data[i].clear();
   }
 
   // Clearing the buffer. Prepare the object for printing levels from comments
@@ -562,15 +903,21 @@ bool BaseParser::ColumnAcquirer::Acquire(const string& server, const string& dat
 }
 
 // Deliver structure of table
-// Need two arguments:
+// Need four arguments:
 //   1. outer container of names of columns
 //   2. outer container of printing levels of each column
-bool BaseParser::ColumnAcquirer::Deliver(vector<string>& o_names, vector<int>& o_levels) const
+//   3. outer container of keys of each column
+//   4. outer container of types of each column
+bool BaseParser::ColumnAcquirer::Deliver(vector<string>& o_names, vector<int>& o_levels, vector<string>& o_keys, vector<string>& o_types) const
 {
   if(!o_names.empty())
     o_names.clear();
   if(!o_levels.empty())
     o_levels.clear();
+  if(!o_keys.empty())
+    o_keys.clear();
+  if(!o_types.empty())
+    o_types.clear();
 
   size_t scale = names.size() / 2;
 
@@ -582,10 +929,14 @@ bool BaseParser::ColumnAcquirer::Deliver(vector<string>& o_names, vector<int>& o
 
   o_names.resize(scale);
   o_levels.resize(scale);
+  o_keys.resize(scale);
+  o_types.resize(scale);
   for(size_t i=0;i<scale;++i)
   {
     o_names[i].assign(names[i]);
     o_levels[i] = levels[i];
+    o_keys[i].assign(keys[i]);
+    o_types[i].assign(names[i+scale]);
   }
 
   if(o_names.empty())
@@ -598,20 +949,321 @@ bool BaseParser::ColumnAcquirer::Deliver(vector<string>& o_names, vector<int>& o
 }
 
 
+// ===> BaseParser::SchemaLoader <===
+// Load the structure of table with ColumnAcquirer in background
+class BaseParser::SchemaLoader: public BackgroundTask {
+  const string server;
+  const string database;
+  const int port;
+  const string table;
+public:
+  // Results, valid after Join() if <loaded>
+  vector<string> names;
+  vector<int> levels;
+  vector<string> keys;
+  vector<string> types;
+  bool loaded;
+
+  SchemaLoader(const string& s, const string& d, int p, const string& t):
+    server(s), database(d), port(p), table(t), loaded(false)
+  {}
+  ~SchemaLoader() { Join(); }
+private:
+  void Run()
+  {
+    ColumnAcquirer tool;
+    loaded = tool.Acquire(server, database, port, table) &&
+             tool.Deliver(names, levels, keys, types);
+  }
+};
+
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+// ===> BaseParser::Resolver <===
+// Convert the domain name of the server into the IP address to connect, in
+// background. All addresses of the name are tried at the same time (a new
+// attempt every <stagger> ms, see RFC 8305 "Happy Eyeballs"), so that a dead
+// or slow one doesn't stall the startup. Addresses are cached in HOME for
+// <ttl> seconds.
+class BaseParser::Resolver: public BackgroundTask {
+  const string server;
+  const int port;
+  // Lifetime of cached addresses (s)
+  static const long ttl = 3600;
+  // Delay between two attempts to connect (ms)
+  static const long stagger = 250;
+  // Give up racing after (ms)
+  static const long patience = 5000;
+public:
+  // Result, valid after Join(). Empty if not resolved
+  string address;
+
+  Resolver(const string& s, int p): server(s), port(p) {}
+  ~Resolver() { Join(); }
+private:
+  void Run();
+  // Look up the DNS. Addresses of different families interleave.
+  bool Resolve(vector<string>& addresses) const;
+  // Index of the first address accepting a connection, -1 if none
+  int Race(const vector<string>& addresses) const;
+  // Cache of addresses: one line for each name,
+  //   <name>\t<expiry (time_t)>\t<address>[,<address>...]
+  static string CacheName();
+  bool ReadCache(vector<string>& addresses) const;
+  void WriteCache(const vector<string>& addresses) const;
+};
+
+namespace {
+  // Milliseconds elapsed since an arbitrary moment
+  long long NowInMS()
+  {
+    timeval now;
+    gettimeofday(&now, 0);
+    return now.tv_sec * 1000LL + now.tv_usec / 1000;
+  }
+}
+
+// Find the address: cached ones at first, then the DNS if none responds
+void BaseParser::Resolver::Run()
+{
+  vector<string> addresses;
+  bool cached = ReadCache(addresses);
+  if(!cached && !Resolve(addresses))
+    return;
+
+  int winner = Race(addresses);
+  if(-1 == winner && cached)
+  {
+    // The cache may be out of date
+    addresses.clear();
+    cached = false;
+    if(!Resolve(addresses))
+      return;
+    winner = Race(addresses);
+  }
+
+  if(!cached)
+    WriteCache(addresses);
+  // If none responds, leave the error to the MySQL library
+  address.assign(addresses[-1 == winner ? 0 : winner]);
+}
+
+// getaddrinfo for all addresses of <server>
+bool BaseParser::Resolver::Resolve(vector<string>& addresses) const
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = 0;
+  int state = getaddrinfo(server.c_str(), 0, &hints, &found);
+  if(state)
+  {
+    cerr << "Can't resolve |" << server << "|: " << gai_strerror(state) << endl;
+    return false;
+  }
+
+  vector<string> ipv6, ipv4;
+  for(addrinfo* it = found; it; it = it->ai_next)
+  {
+    char str[NI_MAXHOST] = {0};
+    if(getnameinfo(it->ai_addr, it->ai_addrlen, str, sizeof(str), 0, 0, NI_NUMERICHOST))
+      continue;
+    vector<string>& family = AF_INET6 == it->ai_family ? ipv6 : ipv4;
+    if(family.end() == find(family.begin(), family.end(), str))
+      family.push_back(str);
+  }
+  freeaddrinfo(found);
+
+  // Preference of the system first (usually IPv6), then alternately
+  for(size_t i=0;i<ipv6.size() || i<ipv4.size();++i)
+  {
+    if(i < ipv6.size())
+      addresses.push_back(ipv6[i]);
+    if(i < ipv4.size())
+      addresses.push_back(ipv4[i]);
+  }
+  return !addresses.empty();
+}
+
+// Connect to <addresses> without blocking, one more every <stagger> ms until
+// one succeeds
+int BaseParser::Resolver::Race(const vector<string>& addresses) const
+{
+  ostringstream service;
+  service << port;
+
+  vector<pollfd> attempts;
+  vector<int> owners;
+  int winner = -1;
+  size_t next = 0;
+  long long deadline = NowInMS() + patience;
+  long long next_start = NowInMS();
+  while(-1 == winner)
+  {
+    long long now = NowInMS();
+    if(now >= deadline || (attempts.empty() && next >= addresses.size()))
+      break;
+
+    // Start a new attempt
+    if(next < addresses.size() && (now >= next_start || attempts.empty()))
+    {
+      addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+      addrinfo* target = 0;
+      if(!getaddrinfo(addresses[next].c_str(), service.str().c_str(), &hints, &target))
+      {
+        int fd = socket(target->ai_family, SOCK_STREAM, 0);
+        if(-1 != fd)
+        {
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+          if(!connect(fd, target->ai_addr, target->ai_addrlen))
+            winner = next;
+          if(-1 == winner && EINPROGRESS == errno)
+          {
+            pollfd one = { fd, POLLOUT, 0 };
+            attempts.push_back(one);
+            owners.push_back(next);
+          }
+          else
+            close(fd);
+        }
+        freeaddrinfo(target);
+      }
+      ++next;
+      next_start = now + stagger;
+      continue;
+    }
+
+    // Wait for any of the attempts, or the time to start another
+    long long wait = deadline - now;
+    if(next < addresses.size() && next_start - now < wait)
+      wait = next_start - now;
+    if(attempts.empty() || 0 >= poll(&attempts[0], attempts.size(), wait))
+      continue;
+
+    for(size_t i=0;i<attempts.size() && -1 == winner;)
+    {
+      if(!attempts[i].revents)
+      {
+        ++i;
+        continue;
+      }
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if(!getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) && !error)
+      {
+        winner = owners[i];
+        break;
+      }
+      // A failed one: the next is started at once
+      close(attempts[i].fd);
+      attempts.erase(attempts.begin() + i);
+      owners.erase(owners.begin() + i);
+      next_start = NowInMS();
+    }
+  }
+
+  for(size_t i=0;i<attempts.size();++i)
+    close(attempts[i].fd);
+  return winner;
+}
+
+// Name of file caching addresses
+string BaseParser::Resolver::CacheName()
+{
+  const char* home = getenv("HOME");
+  if(!home)
+    return "";
+  string cache_name(home);
+  if(!boost::ends_with(cache_name, "/"))
+    cache_name.append("/");
+  cache_name.append(".TwoTools.hosts");
+  return cache_name;
+}
+
+// Returns true if unexpired addresses of <server> are cached
+bool BaseParser::Resolver::ReadCache(vector<string>& addresses) const
+{
+  string cache_name(CacheName());
+  if(cache_name.empty())
+    return false;
+  ifstream in(cache_name.c_str());
+  string line;
+  while(getline(in, line))
+  {
+    vector<string> items;
+    boost::split(items, line, boost::is_any_of("\t"));
+    if(3 != items.size() || server != items[0])
+      continue;
+    if(atol(items[1].c_str()) < time(0))
+      return false;
+    boost::split(addresses, items[2], boost::is_any_of(","));
+    return !addresses.front().empty();
+  }
+  return false;
+}
+
+// Save addresses of <server>, keeping those of other names
+void BaseParser::Resolver::WriteCache(const vector<string>& addresses) const
+{
+  string cache_name(CacheName());
+  if(cache_name.empty())
+    return;
+
+  vector<string> others;
+  ifstream in(cache_name.c_str());
+  string line;
+  time_t now = time(0);
+  while(getline(in, line))
+  {
+    vector<string> items;
+    boost::split(items, line, boost::is_any_of("\t"));
+    if(3 == items.size() && server != items[0] && atol(items[1].c_str()) >= now)
+      others.push_back(line);
+  }
+  in.close();
+
+  ostringstream out;
+  for(size_t i=0;i<others.size();++i)
+    out << others[i] << '\n';
+  out << server << '\t' << now + ttl << '\t' << boost::join(addresses, ",") << '\n';
+  WriteFileAtomically(cache_name, out.str());
+}
+
+
 // ===> BaseParser <===
 // Base class of SelectionTool and OperationTool
 // Constructor
 BaseParser::BaseParser():
   default_account("anonymous"),	// Default account
-  default_password("testing")	// Default password
+  default_password("testing"),	// Default password
+  schema_loader(0),
+  resolver(0),
+  cached_schema(false),
+  offline(false),
+  timing(false)
 {
   port = 3306;
   number_of_columns = 0;
+  gettimeofday(&start_time, 0);
 }
 
-// Destructor
+// Destructor (waits for the jobs in background if any)
 BaseParser::~BaseParser()
-{}
+{
+  delete schema_loader;
+  delete resolver;
+}
 
 // General components assembler and some common properties both tools share
 // Need 1 argument:
@@ -638,6 +1290,7 @@ void BaseParser::GeneralAssembler(boost::program_options::options_description& o
     ("port,P", value<int>()->default_value(3306), "Port of connection")
     ("options,o", value<string>(), "Options for the query")
     ("type,T", value<string>(), "Type of records concerned")
+    ("timing", "Print the time spent on each stage")
     ("help,h", "Print help message and exit")
     ("manual,m", "Print detailed help message and exit")
   ;
@@ -669,20 +1322,45 @@ void BaseParser::GetGeneralParameters(const boost::program_options::variables_ma
       if(default_password != password)
         general_parameters[2].assign(password);
     }
-    // But default password is trivial and should be acquired
-    if(default_password == general_parameters[2])
-      InteractivePassword();
 
     if(v_map.count("port"))
       port = v_map["port"].as<int>();
+    timing = v_map.count("timing");
+
+    // Jobs without the need of password start now, and run while the
+    // password is typed: resolving the server, and loading the structure of
+    // the table (by the default account). With a cache of the structure, the
+    // loading only checks the cache and is waited for by SchemaConfirmed().
+    // "localhost" is left to the MySQL library (it means a local socket).
+    // Offline, nothing but the cache is used.
+    if(!offline && !general_parameters[0].empty() && "localhost" != general_parameters[0])
+    {
+      resolver = new Resolver(general_parameters[0], port);
+      resolver->Start();
+    }
+    if(!general_parameters[3].empty() && !general_parameters[4].empty())
+    {
+      cached_schema = ReadSchemaCache();
+      if(offline && !cached_schema)
+        throw runtime_error(" no cached structure of table (" + SchemaCacheName() + "), needed offline; run once with the server");
+      else if(!offline)
+      {
+        schema_loader = new SchemaLoader(general_parameters[0], general_parameters[3], port, general_parameters[4]);
+        schema_loader->Start();
+      }
+    }
+
+    // But default password is trivial and should be acquired
+    if(!offline && default_password == general_parameters[2])
+      InteractivePassword();
   } catch(exception& e) {
     throw runtime_error(e.what());
   }
 
-  // Check if all general parameters are ready.
+  // Check if all general parameters are ready (no password needed offline).
   for(int i=0;i<5;++i)
   {
-    if(general_parameters[i].empty())
+    if(general_parameters[i].empty() && !(offline && 2 == i))
       throw runtime_error(" unavailable " + general_parameter_names[i]);
   }
   // Checking for repulsive options
@@ -690,6 +1368,8 @@ void BaseParser::GetGeneralParameters(const boost::program_options::variables_ma
   if(!repulsive.empty())
     throw runtime_error(repulsive);
 
+  if(cached_schema)
+    return;
   try {
     PrepareColumns();
   } catch(runtime_error& e) {
@@ -710,39 +1390,13 @@ void BaseParser::InteractivePassword()
     general_parameters[2].clear();
 }
 
-#include <netdb.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-// Use DNS to convert the domain name of the server into its IP address
-void BaseParser::AcquiringRealServer()
+// IP address of the server, from the resolver if any
+string BaseParser::Address() const
 {
-  if(general_parameters[0].empty())
-  {
-    cerr << "No hint for server available..." << endl;
-    return;
-  }
-
-  int expected = general_parameters[0][0] - '0';
-  if(0 <= expected && 3 > expected)	// the first char is 0, 1 or 2:
-    return;				// all numbers assumed
-
-  string ptr = general_parameters[0];
-  struct hostent *hptr = gethostbyname(ptr.c_str());
-  if(hptr == NULL)
-  {
-    cerr << "gethostbyname error: |" << ptr << "|." << endl;
-    return;
-  }
-
-  if(AF_INET == hptr->h_addrtype || AF_INET6 == hptr->h_addrtype)
-  {
-    char str[32] = {0};
-    general_parameters[0].assign(
-        inet_ntop(hptr->h_addrtype, hptr->h_addr, str, sizeof(str))
-    );
-  }
-  else
-    general_parameters[0].clear();
+  if(!resolver)
+    return general_parameters[0];
+  resolver->Join();
+  return resolver->address.empty() ? general_parameters[0] : resolver->address;
 }
 
 // Parse the option file acquired by terminal arguments
@@ -911,15 +1565,24 @@ void BaseParser::PrepareColumns() throw(runtime_error)
     throw runtime_error("NULL DATABASE");
   }
 
-  ColumnAcquirer tool;
-  if(!tool.Acquire(general_parameters[0], general_parameters[3], port, general_parameters[4]))
+  // The loading may have been started already
+  if(!schema_loader)
+  {
+    schema_loader = new SchemaLoader(general_parameters[0], general_parameters[3], port, general_parameters[4]);
+    schema_loader->Start();
+  }
+  schema_loader->Join();
+  if(!schema_loader->loaded)
   {
     cerr << "Can't load the columns..." << endl;
     throw runtime_error("NO COLUMN");
   }
 
-  // In the calling below, three arguments are all updated
-  if(!tool.Deliver(name_of_columns, level_of_columns))
+  name_of_columns.assign(schema_loader->names.begin(), schema_loader->names.end());
+  level_of_columns.assign(schema_loader->levels.begin(), schema_loader->levels.end());
+  key_of_columns.assign(schema_loader->keys.begin(), schema_loader->keys.end());
+  type_of_columns.assign(schema_loader->types.begin(), schema_loader->types.end());
+  if(name_of_columns.empty())
     throw runtime_error("No column received");
 
   // Update the value of number_of_columns
@@ -932,11 +1595,154 @@ void BaseParser::PrepareColumns() throw(runtime_error)
     os << " <===> " << level_of_columns.size();
     throw runtime_error(os.str());
   }
+
+  WriteSchemaCache(name_of_columns, level_of_columns, key_of_columns, type_of_columns);
+}
+
+// Name of the file caching the structure of table
+string BaseParser::SchemaCacheName() const
+{
+  const char* home = getenv("HOME");
+  if(!home)
+    return "";
+
+  ostringstream os;
+  os << home;
+  if(!boost::ends_with(os.str(), "/"))
+    os << "/";
+  os << ".TwoTools." << general_parameters[0] << "_" << port << "."
+     << general_parameters[3] << "." << general_parameters[4] << ".schema";
+  return os.str();
+}
+
+// Load the structure of table from the cache
+// Each line: <name>\t<printing level>\t<key>\t<type>. The type is missing in
+// caches of earlier versions: they are found changed, and refreshed.
+// Returns true if loaded
+bool BaseParser::ReadSchemaCache()
+{
+  string cache_name(SchemaCacheName());
+  if(cache_name.empty())
+    return false;
+  ifstream in(cache_name.c_str());
+  if(!in.is_open())
+    return false;
+
+  vector<string> names, keys, types;
+  vector<int> levels;
+  string line;
+  while(getline(in, line))
+  {
+    vector<string> items;
+    boost::split(items, line, boost::is_any_of("\t"));
+    if((3 != items.size() && 4 != items.size()) || items[0].empty())
+    {
+      cerr << "Warning... Bad cache of the structure of table: " << cache_name << endl;
+      return false;
+    }
+    names.push_back(items[0]);
+    levels.push_back(atoi(items[1].c_str()));
+    keys.push_back(items[2]);
+    if(4 == items.size())
+      types.push_back(items[3]);
+  }
+  if(names.empty())
+    return false;
+
+  name_of_columns.swap(names);
+  level_of_columns.swap(levels);
+  key_of_columns.swap(keys);
+  type_of_columns.swap(types);
+  number_of_columns = name_of_columns.size();
+  return true;
+}
+
+// Save the structure of table into the cache
+void BaseParser::WriteSchemaCache(const vector<string>& names, const vector<int>& levels, const vector<string>& keys, const vector<string>& types) const
+{
+  string cache_name(SchemaCacheName());
+  if(cache_name.empty())
+    return;
+
+  ostringstream out;
+  for(size_t i=0;i<names.size();++i)
+    out << names[i] << '\t' << levels[i] << '\t' << keys[i] << '\t' << types[i] << '\n';
+  if(!WriteFileAtomically(cache_name, out.str()))
+    cerr << "Warning... Can't save the structure of table into " << cache_name << endl;
+}
+
+// Wait for the check of the cached structure of table
+bool BaseParser::SchemaConfirmed() const
+{
+  if(!cached_schema || !schema_loader)
+    return true;
+
+  schema_loader->Join();
+  if(!schema_loader->loaded)
+  {
+    cerr << "Warning... Can't check the cached structure of table..." << endl;
+    return true;
+  }
+  if(schema_loader->names == name_of_columns &&
+     schema_loader->levels == level_of_columns &&
+     schema_loader->keys == key_of_columns &&
+     schema_loader->types == type_of_columns)
+    return true;
+
+  WriteSchemaCache(schema_loader->names, schema_loader->levels, schema_loader->keys, schema_loader->types);
+  cerr << "\033[31mStructure of " << general_parameters[4] << " has changed since cached. Cache refreshed, please run again...\033[0m" << endl;
+  return false;
+}
+
+// Print the time since the start
+void BaseParser::ReportTime(const string& stage) const
+{
+  if(!timing)
+    return;
+  timeval now;
+  gettimeofday(&now, 0);
+  long ms = (now.tv_sec - start_time.tv_sec) * 1000 + (now.tv_usec - start_time.tv_usec) / 1000;
+  cerr << "Time until " << stage << ": " << ms << " ms" << endl;
 }
 
 size_t BaseParser::N_Records() const
 { return 200; }
 
+// Whether the server keeps values of <column> unique
+bool BaseParser::UniqueColumn(const string& column) const
+{
+  vector<string>::const_iterator it = find(name_of_columns.begin(), name_of_columns.end(), column);
+  if(name_of_columns.end() == it || key_of_columns.size() != name_of_columns.size())
+    return false;
+
+  const string& key = key_of_columns[it - name_of_columns.begin()];
+  if("UNI" == key)
+    return true;
+  else if("PRI" != key)
+    return false;
+
+  // "PRI" is shown for each column of a composite primary key
+  return 1 == count(key_of_columns.begin(), key_of_columns.end(), "PRI");
+}
+
+// Whether the server compares values of <column> as numbers
+bool BaseParser::NumericColumn(const string& column) const
+{
+  vector<string>::const_iterator it = find(name_of_columns.begin(), name_of_columns.end(), column);
+  if(name_of_columns.end() == it || type_of_columns.size() != name_of_columns.size())
+    return false;
+
+  const string& type = type_of_columns[it - name_of_columns.begin()];
+  static const char* numeric[] = { "tinyint", "smallint", "mediumint", "int", "bigint",
+                                   "decimal", "numeric", "float", "double", "real", "year" };
+  for(size_t i=0;i<sizeof(numeric)/sizeof(numeric[0]);++i)
+  {
+    if(boost::istarts_with(type, numeric[i]))
+      return true;
+  }
+  return false;
+}
+
 // Retrieve names of columns
 // Need 2 arguments:
 //   1. outer container
@@ -967,7 +1773,8 @@ RecordsHolder::RecordsHolder():
   first_column(),
   number_of_columns(0),
   number_of_records(0),
-  name_of_columns()
+  name_of_columns(),
+  detecting_duplicates(true)
 {}
 
 // Ingest the common info for RecordsHolder from terminal via BaseParser
@@ -983,6 +1790,18 @@ bool RecordsHolder::Initialize(const BaseParser& parser)
   return true;
 }
 
+// Ingest names of columns directly
+bool RecordsHolder::Initialize(const vector<string>& names)
+{
+  if(names.empty())
+    return false;
+
+  name_of_columns.assign(names.begin(), names.end());
+  number_of_columns = name_of_columns.size();
+
+  return true;
+}
+
 // Insert a record, elements of vector being each column
 void RecordsHolder::Insert(const vector<string>& record, int index_of_lfn)
 {
@@ -991,6 +1810,13 @@ void RecordsHolder::Insert(const vector<string>& record, int index_of_lfn)
     cerr << "NULL RECORD..." << endl;
     return;
   }
+  else if(!detecting_duplicates)
+  {
+    // Records are known to be unique. No token is necessary.
+    records.push_back(record);
+    ++number_of_records;
+    return;
+  }
   else if(-1 == index_of_lfn)
   {
     cerr << "No index of LFN received..." << endl;
@@ -1023,7 +1849,7 @@ void RecordsHolder::Insert(const vector<string>& record, int index_of_lfn)
   else
     token.assign(record[index_of_lfn]);
 
-  if(first_column.end() != find(first_column.begin(), first_column.end(), token))
+  if(!first_column.insert(token).second)
   {
     // Inserted records are omitted.
     cerr << "This record has been inserted..." << endl;
@@ -1032,10 +1858,37 @@ void RecordsHolder::Insert(const vector<string>& record, int index_of_lfn)
   }
 
   records.push_back(record);
-  first_column.push_back(token);
   ++number_of_records;
 }
 
+// Take records of another RecordsHolder
+void RecordsHolder::Insert(RecordsHolder& other, int index_of_lfn)
+{
+  if(records.empty() && !detecting_duplicates)
+  {
+    records.swap(other.records);
+    number_of_records = records.size();
+  }
+  else
+  {
+    records.reserve(records.size() + other.records.size());
+    for(size_t i=0;i<other.records.size();++i)
+      Insert(other.records[i], index_of_lfn);
+  }
+  other.records.clear();
+  other.first_column.clear();
+  other.number_of_records = 0;
+}
+
+// Give away all records
+void RecordsHolder::Release(vector<vector<string> >& target)
+{
+  target.clear();
+  target.swap(records);
+  first_column.clear();
+  number_of_records = 0;
+}
+
 // Insert a record, with all columns joined by one char in <separator>
 void RecordsHolder::Insert(const string& record, const string& separator)
 {
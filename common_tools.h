@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <set>
 
 // Configuration information
 class Configuration {
@@ -18,6 +19,54 @@ public:
   bool Authenticating(const std::string& real_key) const;
 };
 
+// A job run on a thread of its own, so that independent steps (e.g. loading
+// the structure of a table while the password is typed) overlap.
+// Derived classes implement Run() and shall call Join() in their destructor.
+#include <pthread.h>
+class BackgroundTask {
+  pthread_t thread;
+  bool running;
+  BackgroundTask(const BackgroundTask&);
+  BackgroundTask& operator=(const BackgroundTask&);
+  static void* Entry(void* task);
+protected:
+  // The job itself
+  virtual void Run() = 0;
+public:
+  BackgroundTask(): running(false) {}
+  virtual ~BackgroundTask() {}
+
+  // Start the job. It is done in the calling thread if no thread available.
+  void Start();
+  // Wait for the job to finish. Returns at once if not started.
+  void Join();
+};
+
+// A file mapped into memory (read only), to be read sequentially: lines are
+// taken as [begin, end) of the mapping, with no copy.
+class MappedFile {
+  const char* data;
+  size_t size;
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+public:
+  MappedFile(): data(0), size(0) {}
+  ~MappedFile() { Close(); }
+
+  // Map <filename>. Returns false if it can't be, e.g. not a regular file
+  // (an empty file is mapped as nothing)
+  bool Open(const std::string& filename);
+  void Close();
+  const char* Begin() const { return data; }
+  const char* End() const { return data + size; }
+  size_t Size() const { return size; }
+};
+
+// Replace the file <name> by <content>. It is written aside, under a name of
+// this process, and then renamed, so that a reader never sees half a file,
+// even while other runs write it. Returns false if it can't be saved.
+bool WriteFileAtomically(const std::string& name, const std::string& content);
+
 #include <mysql/mysql.h>
 // MySQL interface. Designed to be inherited.
 class MySQLInterface {
@@ -40,6 +89,12 @@ protected:
   // Number of columns
   unsigned long fields;
 
+  // max_allowed_packet of the server (0 if not queried yet)
+  unsigned long max_packet;
+
+  // Errors expected (e.g. of "drop table if exists") are not printed
+  bool quiet;
+
   // Constructor
   MySQLInterface();
   // Destructor
@@ -64,7 +119,20 @@ protected:
   bool GetDataFromDB(const std::string&,
                      std::vector<std::vector<std::string> >&);
 
-  // Either of the three methods takes mysql query command as the argument, and
+public:
+  // Receiver of records streamed one by one from database
+  class RowReceiver {
+  public:
+    virtual ~RowReceiver() {}
+    // <row> is reused for the next record, take whatever is needed
+    virtual void operator()(std::vector<std::string>& row) = 0;
+  };
+protected:
+  // Retrieve data from database without buffering the whole result: each
+  // record is handed to <receiver> as soon as it arrives.
+  bool StreamDataFromDB(const std::string&, RowReceiver& receiver);
+
+  // Either of the four methods takes mysql query command as the argument, and
   // their implementation looks so similar that mix-use only brings about
   // contextual concerns.
   // Returns false if query is rejected or if query fails, true if executed
@@ -74,10 +142,35 @@ protected:
   bool Update(const std::string& queryStr);
   // Delete
   bool Delete(const std::string& queryStr);
+  // Replacer (insert, or delete and insert if the key exists)
+  bool Replace(const std::string& queryStr);
 
   // MySQL query command executer. Handles any command.
   bool DirectQuery(const std::string& queryStr);
 
+  // Create a temporary table (alive during this session only)
+  // 2 arguments:
+  //   1: name of the table
+  //   2: definition of columns, e.g. "(name varchar(16) not null)"
+  bool CreateTemporaryTable(const std::string& name, const std::string& definition);
+
+  // Multi-row insertion. Tuples are joined into "<head> (...),(...),..." as
+  // few commands as possible, each of which is kept under max_allowed_packet
+  // 3 arguments:
+  //   1: command up to "values" ("insert into <table> (<columns>) values ")
+  //   2: tuples to insert, each like "('a', 'b')"
+  //   3: maximal size of a command (0 for max_allowed_packet of the server)
+  // Returns false if any of the commands fails
+  bool BatchInsert(const std::string& head, const std::vector<std::string>& tuples, unsigned long packet_size = 0);
+
+  // Size limit of a query command from the server (queried only once)
+  unsigned long MaxAllowedPacket();
+
+  // Escape special characters of <value> to be quoted in a query command
+  std::string Escape(const std::string& value);
+  // The same, appending the result to <target> (no temporary string)
+  void AppendEscaped(std::string& target, const std::string& value);
+
   // Clear the buffer within
   void ClearData()
   {
@@ -104,7 +197,7 @@ protected:
   // Returns the status of streaming the records
   bool GetNameOfColumns(std::vector<std::string>&) const;
 
-  // Print the error message of last MySQL query if any
+  // Print the error message of last MySQL query if any (not if quiet)
   void errorIntoMySQL();
 
 public:
@@ -116,12 +209,36 @@ public:
   static void PrintingValues( const std::vector<std::vector<std::string> >& data, const std::vector<std::string>& names_of_column);
 
 private:
+  // Escaping values into its buffer
+  friend class StatementBuilder;
   void closeMySQL();
   bool GenerateNameOfColumns(std::vector<std::string>&) const;
   bool TestingQueryCommand(const std::string&, const std::string&);
   bool Non_Select_Query(const std::string&);
 };
 
+// Writer of query commands in one pass into a buffer kept from one command
+// to the next. Values are quoted and escaped as they are written, with
+// true/false as 1/0, so that a command needs no rewriting afterwards.
+class StatementBuilder {
+  std::string buffer;
+  // Connection whose character set is used for escaping (by hand if none)
+  MySQLInterface* connection;
+public:
+  explicit StatementBuilder(MySQLInterface* c = 0): connection(c)
+  { buffer.reserve(1024); }
+
+  // Start a new command (the memory is kept)
+  StatementBuilder& Clear() { buffer.clear(); return *this; }
+  // Words of the command, as they are
+  StatementBuilder& Append(const std::string& words) { buffer.append(words); return *this; }
+  StatementBuilder& Append(const char* words) { buffer.append(words); return *this; }
+  // A value, quoted: 'value'
+  StatementBuilder& Value(const std::string& value);
+
+  const std::string& Command() const { return buffer; }
+};
+
 namespace boost {
   namespace program_options {
     class options_description;
@@ -138,27 +255,33 @@ class RecordsHolder {
   // All records
   std::vector<std::vector<std::string> > records;
   // First two rows of records, trying to remove repetition
-  std::vector<std::string> first_column;
+  std::set<std::string> first_column;
   // Number of vector of string in records. Same to the size of first_column
   size_t number_of_records;
   // Names of columns
   std::vector<std::string> name_of_columns;
   // Number of columns. Remain still after initialization.
   size_t number_of_columns;
+  // Whether to omit repeated records while inserting
+  bool detecting_duplicates;
 public:
   // (Default) constructor
   RecordsHolder();
 
   // Initialize name and number of columns, make ready the two vector
   bool Initialize(const BaseParser& parser);
+  // Initialize with names of columns directly (e.g. for summaries)
+  bool Initialize(const std::vector<std::string>& names);
 
-  // Reserve memory for records and first_column;
-  // Only the size of records and first_column
+  // Switch on/off the check of repetition in Insert (on by default). Turn it
+  // off if records are known to be unique, e.g. summaries from "group by".
+  void DetectDuplicates(bool v) { detecting_duplicates = v; }
+
+  // Reserve memory for records
   void Reserve(size_t first)
   {
     if(1e6 < first) return;
     records.reserve(first);
-    first_column.reserve(first);
   }
 
   // Getters of two scales
@@ -170,6 +293,11 @@ public:
   void Insert(const std::vector<std::string>& record, int index_of_lfn = -2);
   // Insert with a string separated by <separator> (v2)
   void Insert(const std::string& record, const std::string& separator = ";");
+  // Insert all records of <other> in order (v3). <other> is emptied.
+  void Insert(RecordsHolder& other, int index_of_lfn = -2);
+
+  // Move all records into <target> (no copy), emptying this holder
+  void Release(std::vector<std::vector<std::string> >& target);
 
   // Retrieve a record from RecordsHolder, index as the argument
   // Retrieve using a vector.
@@ -192,6 +320,7 @@ private:
 
 
 #include <stdexcept>
+#include <sys/time.h>
 // Argument parser base. Contains general parameters shared by both selection
 // tool and operation tool
 class BaseParser {
@@ -205,13 +334,19 @@ class BaseParser {
     using MySQLInterface::fields;
     std::vector<std::string> names;
     std::vector<int> levels;
+    // "Key" of each column from "describe": PRI, UNI, MUL or empty
+    std::vector<std::string> keys;
   public:
     ColumnAcquirer();
     bool Acquire(const std::string& server,
                  const std::string& database,
                  int port, const std::string& table);
-    bool Deliver(std::vector<std::string>& o_names, std::vector<int>& o_levels) const;
+    bool Deliver(std::vector<std::string>& o_names, std::vector<int>& o_levels, std::vector<std::string>& o_keys, std::vector<std::string>& o_types) const;
   };
+  // Run ColumnAcquirer in background
+  class SchemaLoader;
+  // Resolve the name of server in background
+  class Resolver;
 
 protected:
   // Only general parameters used by both SelectionTool and OperationTool
@@ -231,9 +366,28 @@ protected:
   size_t number_of_columns;
   // 9. Printing level of columns
   std::vector<int> level_of_columns;
+  // 10. Key of columns (PRI, UNI, MUL or empty, as in "describe")
+  std::vector<std::string> key_of_columns;
+  // 11. Type of columns (as in "describe", e.g. "int(10) unsigned")
+  std::vector<std::string> type_of_columns;
 
   const std::string default_account;
   const std::string default_password;
+
+  // Jobs started during parsing and joined when their results are needed
+  SchemaLoader* schema_loader;
+  Resolver* resolver;
+  // Whether the structure of table is from the cache (thus to be confirmed)
+  bool cached_schema;
+  // Whether to work without the server: no password, no resolution, and the
+  // structure of table from the cache only. Set before GetGeneralParameters.
+  bool offline;
+
+  // Whether to print the time spent on each stage ("--timing")
+  bool timing;
+  // Moment this parser is created
+  timeval start_time;
+
   // Constructor
   BaseParser();
   // Destructor
@@ -265,9 +419,6 @@ private:
   // Take in password from terminal interactively
   void InteractivePassword();
 
-  // (For server:) turn domain name into string of 4 numbers (IP)
-  void AcquiringRealServer();
-
   // Title of general parameter names
   static const std::string general_parameter_names[6];
   // Read <option_file> for login info such as user, passwd, database, etc.
@@ -285,10 +436,19 @@ private:
   // Called before the real query and after the parsing of terminals by GetGeneralParameters
   std::string ReplusiveOptions(const boost::program_options::variables_map& v_map);
 
-  // Components for general parameters parser (7 - 9)
+  // Components for general parameters parser (7 - 10)
   // Called before the real query and after the parsing of terminals by GetGeneralParameters
   void PrepareColumns() throw(std::runtime_error);
 
+  // Cache of the structure of table, so that it is loaded without a query
+  // Cache file: $HOME/.TwoTools.<server>_<port>.<database>.<table>.schema
+  std::string SchemaCacheName() const;
+  bool ReadSchemaCache();
+  void WriteSchemaCache(const std::vector<std::string>& names, const std::vector<int>& levels, const std::vector<std::string>& keys, const std::vector<std::string>& types) const;
+
+  BaseParser(const BaseParser&);
+  BaseParser& operator=(const BaseParser&);
+
 public:
   // Returns true if not parsed.
   bool NotReady() const
@@ -304,8 +464,27 @@ public:
   std::string Database() const { return general_parameters[3]; }
   std::string Table() const { return general_parameters[4]; }
   int Port() const { return port; }
+  // IP address of the server (the name itself if it can't be resolved).
+  // Waits for the resolution if still running.
+  std::string Address() const;
   virtual void Columns(std::vector<std::string>& target, int level = -2) const;	// name_of_columns
   size_t N_Columns() const { return number_of_columns; }
+
+  // Returns true if values of <column> are guaranteed unique by the server,
+  // i.e. it is the only column of the primary key, or a unique key.
+  bool UniqueColumn(const std::string& column) const;
+
+  // Returns true if <column> is of a numeric type (integer, decimal or
+  // floating point), whose values the server compares as numbers.
+  bool NumericColumn(const std::string& column) const;
+
+  // If the structure of table was taken from the cache, wait for it to be
+  // checked against the server. Returns false if it has changed (the cache
+  // is refreshed, but columns used by this run are out of date).
+  bool SchemaConfirmed() const;
+
+  // Print the time since start with "--timing"
+  void ReportTime(const std::string& stage) const;
 };
 
 #endif // COMMON_TOOLS_H
@@ -21,6 +21,8 @@ int main(int argc, const char* argv[])
     return parse_state;
   }
 
+  parser.ReportTime("arguments parsed");
+
   // Create an OperationTool
   OperationTool tool(parser.Holder());
 
@@ -39,6 +41,7 @@ int main(int argc, const char* argv[])
   }
   else
   {
+    parser.ReportTime("records processed");
     cout << "Date processed." << endl;
     return 0;
   }
@@ -21,15 +21,19 @@ int main(int argc, const char* argv[])
     return parse_state;
   }
 
+  parser.ReportTime("arguments parsed");
+
   // Create a SelectionTool
   SelectionTool tool;
 
   // Initiate the database...
   if(!tool.InitiateDatabase(parser))
     return 1;
+  parser.ReportTime("database initiated");
 
   // Select records, and display
   tool.SelectAndDisplay();
+  parser.ReportTime("records displayed");
 
   return 0;
 }
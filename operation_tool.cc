@@ -2,25 +2,34 @@
 // File: operation_tool.cc
 // Contents: modules used by OperationTool
 // Classes:
+//   JSONScanner
 //   PropertyParser
 //   ArgumentParser
+//   JSONChunkParser
+//   MD5
+//   FileScanner
 //   OperationTool::BaseCommand
 //   OperationTool::InsertionCommand
 //   OperationTool::UpdatingCommand
 //   OperationTool::DeletionCommand
 //   TrivialErrorNullification
+//   TSVStream
+//   OperationTool::MySQLOperator::PreparedInsertion
 //   OperationTool::MySQLOperator
+//   OperationTool::Shard
 //   OperationTool
 // ************************************************************************* //
 
 #include "operation_tool.h"
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <cctype>	// For isspace
+#include <cstdlib>	// For strtoul
 #include <ctime>
+#include <cstring>	// For memcpy, strncpy
 using namespace std;
 
 
@@ -33,69 +42,249 @@ PropertyParser& PropertyParser::GetInstance()
   return instance;
 }
 
+// ===> JSONScanner <===
+// Single-pass JSON tokenizer over a line. Values of an object go straight
+// into a record (by indexes of columns), with no tree nor map in between.
+// Python style is accepted too: 'single quotes', True/False/None.
+namespace {
+  class JSONScanner {
+    const char* const begin;
+    const char* it;
+    const char* const end;
+    const map<string, int>& columns;
+  public:
+    // Reason of failure, if any
+    string error;
+
+    // Scan [b, e), which shall live as long as the scanner
+    JSONScanner(const char* b, const char* e, const map<string, int>& c):
+      begin(b), it(b), end(e), columns(c)
+    {}
+
+    // Next object (in lists of any depth, separated by ',') into <record>.
+    // Returns false at the end of line, or on error (non-empty <error>).
+    bool NextObject(vector<string>& record)
+    {
+      while(true)
+      {
+        SkipSpaces();
+        if(it == end)
+          return false;
+        else if('[' == *it || ']' == *it || ',' == *it)
+          ++it;
+        else if('{' == *it)
+          return Object(record);
+        else
+          return Fail("object expected");
+      }
+    }
+
+  private:
+    bool Fail(const char* reason)
+    {
+      ostringstream os;
+      os << reason << " (at character " << it - begin << ")";
+      error.assign(os.str());
+      return false;
+    }
+
+    void SkipSpaces()
+    {
+      while(it != end && isspace(static_cast<unsigned char>(*it)))
+        ++it;
+    }
+
+    // {"key": value, ...}
+    bool Object(vector<string>& record)
+    {
+      for(size_t i=0;i<record.size();++i)
+        record[i].clear();
+
+      ++it;	// '{'
+      SkipSpaces();
+      if(it != end && '}' == *it)
+      {
+        ++it;
+        return true;
+      }
+      string key, value;
+      while(true)
+      {
+        SkipSpaces();
+        if(it == end || ('"' != *it && '\'' != *it))
+          return Fail("key expected");
+        if(!String(key))
+          return false;
+        SkipSpaces();
+        if(it == end || ':' != *it)
+          return Fail("':' expected");
+        ++it;
+        SkipSpaces();
+        if(it == end)
+          return Fail("value expected");
+
+        map<string, int>::const_iterator position = columns.find(key);
+        if('{' == *it || '[' == *it)
+        {
+          // Nested values are not columns
+          if(!Skip())
+            return false;
+        }
+        else if(!('"' == *it || '\'' == *it ? String(value) : Literal(value)))
+          return false;
+        else if(columns.end() != position)
+          record[position->second].swap(value);
+
+        SkipSpaces();
+        if(it == end)
+          return Fail("'}' expected");
+        else if(',' == *it)
+          ++it;
+        else if('}' == *it)
+        {
+          ++it;
+          return true;
+        }
+        else
+          return Fail("',' or '}' expected");
+      }
+    }
+
+    // "..." or '...', escapes decoded
+    bool String(string& target)
+    {
+      target.clear();
+      const char quote = *it++;
+      while(it != end && quote != *it)
+      {
+        if('\\' != *it)
+        {
+          // Unescaped characters copied at once
+          const char* start = it;
+          while(it != end && quote != *it && '\\' != *it)
+            ++it;
+          target.append(start, it);
+          continue;
+        }
+        if(++it == end)
+          break;
+        switch(*it)
+        {
+          case 'b': target.push_back('\b'); break;
+          case 'f': target.push_back('\f'); break;
+          case 'n': target.push_back('\n'); break;
+          case 'r': target.push_back('\r'); break;
+          case 't': target.push_back('\t'); break;
+          case 'u':
+          {
+            if(end - it < 5)
+              return Fail("bad \\u escape");
+            unsigned long code = strtoul(string(it + 1, it + 5).c_str(), 0, 16);
+            it += 4;
+            // UTF-8
+            if(code < 0x80)
+              target.push_back(code);
+            else if(code < 0x800)
+            {
+              target.push_back(0xC0 | (code >> 6));
+              target.push_back(0x80 | (code & 0x3F));
+            }
+            else
+            {
+              target.push_back(0xE0 | (code >> 12));
+              target.push_back(0x80 | ((code >> 6) & 0x3F));
+              target.push_back(0x80 | (code & 0x3F));
+            }
+            break;
+          }
+          default: target.push_back(*it);	// \" \' \\ \/
+        }
+        ++it;
+      }
+      if(it == end)
+        return Fail("unterminated string");
+      ++it;	// closing quote
+      return true;
+    }
+
+    // Numbers, true/false/null (True/False/None)
+    bool Literal(string& target)
+    {
+      const char* start = it;
+      while(it != end && ',' != *it && '}' != *it && ']' != *it && !isspace(static_cast<unsigned char>(*it)))
+        ++it;
+      target.assign(start, it);
+      if(target.empty())
+        return Fail("value expected");
+      if("True" == target)
+        target.assign("true");
+      else if("False" == target)
+        target.assign("false");
+      else if("null" == target || "None" == target)
+        target.clear();
+      return true;
+    }
+
+    // A nested object or list, skipped
+    bool Skip()
+    {
+      int depth = 0;
+      string ignored;
+      while(it != end)
+      {
+        if('"' == *it || '\'' == *it)
+        {
+          if(!String(ignored))
+            return false;
+          continue;
+        }
+        if('{' == *it || '[' == *it)
+          ++depth;
+        else if(('}' == *it || ']' == *it) && 0 == --depth)
+        {
+          ++it;
+          return true;
+        }
+        ++it;
+      }
+      return Fail("unbalanced brackets");
+    }
+  };
+}
+
 // <Key method> (v1)
 // Parse JSON line <value> and save the results into <holder>
 // Need 2 arguments:
 //   1. JSON string
 //   2. RecordsHolder where the result is stored
 // On format of JSON:
-//   1. list ([JSON1, JSON2, ...]) of JSON is supported
-//   2. true/false expected, but True/False is supported
+//   1. list ([JSON1, JSON2, ...]) of JSON is supported, so are lists of lists
+//   2. true/false expected, but True/False is supported, so are single quotes
 void PropertyParser::ParseJSON(const string& value, RecordsHolder& holder) const
 {
-  if(value.empty())
-    return;
+  ParseJSON(value.data(), value.data() + value.size(), holder);
+}
 
-  vector<string> all_strings;
-  // Support for python lists
-  // A python list must start with a '[' and must ends with a ']', or it's not
-  // recognized.
-  if(string::npos != value.find("}, {") && '[' == value[0] && boost::ends_with(value, "]"))
-  {
-    string splitted(boost::replace_all_copy(value, "}, {", "}#{"));
-    // To support many lists in a line.
-    boost::replace_all(splitted, "},{", "}#{");
-    boost::replace_all(splitted, "], [", "]#[");
-    boost::replace_all(splitted, "] , [", "]#[");
-    boost::replace_all(splitted, "] ,[", "]#[");
-    boost::replace_all(splitted, "],[", "]#[");
-    boost::erase_last(splitted, "]");
-    splitted.erase(0, 1);
-    boost::split(all_strings, splitted, boost::is_any_of("#"));
-  }
-  else
-    all_strings.push_back(value);
-
-  for(vector<string>::iterator it = all_strings.begin(); it != all_strings.end(); ++it)
-  {
-    string c_formated(*it);
-    // Basic replacement of some unrecognized items from python, etc.
-    if(string::npos != c_formated.find("True"))
-      boost::replace_all(c_formated, "True", "true");
-    if(string::npos != c_formated.find("False"))
-      boost::replace_all(c_formated, "False", "false");
-    if(string::npos != c_formated.find("'"))
-      boost::replace_all(c_formated, "'", "\"");
-
-    // After the replacement, parse the JSON string
-    stringstream ss(c_formated);
-    boost::property_tree::ptree pt;
-    try {
-      boost::property_tree::read_json(ss, pt);
-    } catch(boost::property_tree::ptree_error& pt_e) {
-      cout << "\e[31mError parsing \"\e[0m\e[32m" << value << "\e[0m\e[31m\"...\e[0m" << endl;
-      cout << "\e[33m" << pt_e.what() << "\e[0m" << endl;
-      return;
-    }
+// <Key method> (v1, on a slice)
+// The same as above, with the JSON string in [begin, end), e.g. a line of a
+// mapped file (no copy made)
+void PropertyParser::ParseJSON(const char* begin, const char* end, RecordsHolder& holder) const
+{
+  if(begin == end)
+    return;
 
-    // Store the results with a map
-    map<string, string> one_record;
-    for(boost::property_tree::ptree::iterator it = pt.begin(); it != pt.end(); ++it)
-      one_record.insert(make_pair(it->first, it->second.data()));
+  JSONScanner scanner(begin, end, columns);
+  vector<string> one_record(columns.size());
+  while(scanner.NextObject(one_record))
+    Insert(one_record, holder);
 
-    ParseString(one_record, holder);
+  if(!scanner.error.empty())
+  {
+    cout << "\e[31mError parsing \"\e[0m\e[32m" << string(begin, end) << "\e[0m\e[31m\"...\e[0m" << endl;
+    cout << "\e[33m" << scanner.error << "\e[0m" << endl;
   }
 }
+
 // <Key method> (v2)
 // Parse directly a string and save the results into <holder>
 // Need 2 arguments:
@@ -110,28 +299,29 @@ void PropertyParser::ParseString(const map<string, string>& buffer, RecordsHolde
     return;
 
   vector<string> one_record(columns.size());
-  int inserted = -1;
   for(map<string, string>::const_iterator it = buffer.begin(); it != buffer.end(); ++it)
   {
     map<string, int>::const_iterator position = columns.find(it->first);
     if(columns.end() == position)
       continue;
-    if(!it->second.empty())
-    {
-      one_record[position->second].assign(it->second);
-      if("lfn" == it->first)
-      {
-        // lfn found.
-        inserted = position->second;
-        one_record.back().assign(
-            boost::istarts_with(it->second, "root://") ? "1" : "0"
-        );
-      }
-    }
+    one_record[position->second].assign(it->second);
   }
 
-  if(-1 != inserted)
-    holder.Insert(one_record, inserted);
+  Insert(one_record, holder);
+}
+
+// Save a parsed record into <holder> if it has an LFN. "remote" (the last
+// column) is set from the LFN.
+void PropertyParser::Insert(vector<string>& one_record, RecordsHolder& holder) const
+{
+  int index_of_lfn = GetIndex("lfn");
+  if(-1 == index_of_lfn || one_record[index_of_lfn].empty())
+    return;
+
+  one_record.back().assign(
+      boost::istarts_with(one_record[index_of_lfn], "root://") ? "1" : "0"
+  );
+  holder.Insert(one_record, index_of_lfn);
 }
 
 // Take in names of all columns
@@ -152,6 +342,20 @@ ArgumentParser::ArgumentParser()
 {
   operation_mode = undefined_mode;
   terminal_mode = nothing_sent;
+  batch_size = 0;
+  bulk_loading = false;
+  preparing = false;
+  bulk_updating = false;
+  key_deleting = 0;
+  replacing = false;
+  threads = 0;
+  connections = 1;
+  stream_window = 0;
+  commit_every = 0;
+  resume_from = 0;
+  skipping_existing = false;
+  standard_output = 0;
+  reconciling = false;
 }
 
 // Key method
@@ -184,12 +388,33 @@ int ArgumentParser::Parse(int argc, const char* argv[])
 
   // Adding items
   adding.operator()
-    ("json-file,j", value<string>(), "Name of JSON file to be parsed")
+    ("json-file,j", value<vector<string> >()->multitoken(), "Name(s) of JSON file(s) to be parsed (globs accepted)")
+    ("threads", value<int>()->default_value(0), "Threads parsing JSON files or scanning (0: all cores)")
+    ("connections", value<int>()->default_value(1), "Connections sharing records by LFN, each a transaction")
+    ("stream", value<int>()->implicit_value(1000), "Parse and send JSON records by windows of N (default: 1000)")
+    ("commit-every", value<int>()->default_value(0), "Commit every N records, saved in a journal (0: all at once)")
+    ("journal", value<string>(), "Journal of committed records (default: <first JSON file>.journal)")
+    ("resume", "Skip records committed by an earlier run (from the journal)")
+    ("skip-existing", "Skip records whose LFNs are already recorded (insertion only)")
+    ("emit-sql", value<string>(), "Write commands into FILE (\"-\": stdout) rather than sending them")
     ("direct-input,d", "Enable user(s) to input the JSON string from terminal")
-    ("mode,M", value<int>()->default_value(1), "Insert(default)(1)/Update(2)/Delete(3)")
+    ("scan", value<vector<string> >()->multitoken(), "Directories to scan for ROOT files (lfn, size, last_modified)")
+    ("scan-checksum", "With \"scan\", compute MD5 checksums")
+    ("lfn-prefix", value<string>()->default_value(""), "With \"scan\", prefix of LFNs (e.g. root://server/)")
+    ("manifest", value<string>(), "With \"scan-checksum\", file of files scanned, whose checksums are kept if unchanged")
+    ("reconcile", "With \"scan\", insert/update/delete the differences from the table only")
+    ("mode,M", value<int>()->default_value(1), "Insert(default)(1)/Update(2)/Delete(3)/Upsert(4)")
     ("delete-mode", "Switch to delete mode")
     ("update-mode", "Switch to update mode")
+    ("upsert-mode", "Switch to upsert mode (insert, or update if recorded)")
+    ("replace", "Upsert by REPLACE rather than ON DUPLICATE KEY UPDATE")
     ("multi-tables", "Allowing different types of ROOT files")
+    ("batch-size", value<int>()->default_value(0), "Records per insertion (0: as many as allowed)")
+    ("bulk-load", "Insert all records by LOAD DATA LOCAL INFILE")
+    ("prepared", "Insert records by prepared statements")
+    ("bulk-update", "Update records by a join with a staging table")
+    ("by-key", "Delete records by LFN only, in batches")
+    ("verify", "With \"by-key\", check other columns before deletion")
     ("lfn,f", value<string>(), "Logical file name")
     ("tstop,e", value<string>(), "Timestamp of last event")
     ("tstart,b", value<string>(), "Timestamp of first event")
@@ -206,11 +431,18 @@ int ArgumentParser::Parse(int argc, const char* argv[])
 
   // Reserve repulsive options
   ReserveRepulsiveOptions("delete-mode", "update-mode");
+  ReserveRepulsiveOptions("upsert-mode", "update-mode");
+  ReserveRepulsiveOptions("upsert-mode", "delete-mode");
   ReserveRepulsiveOptions("json-file", "direct-input");
+  ReserveRepulsiveOptions("scan", "json-file");
+  ReserveRepulsiveOptions("scan", "direct-input");
   string items[] = { "lfn", "tstop", "tstart", "size", "nevts", "SvnRev", "version", "comment", "emax", "emin", "last_modified", "checksum" };
   int N_items = sizeof(items)/sizeof(items[0]);
   for(int i=0;i<N_items;++i)
+  {
     ReserveRepulsiveOptions("json-file", items[i].c_str());
+    ReserveRepulsiveOptions("scan", items[i].c_str());
+  }
 
   // Parse the arguments
   boost::program_options::variables_map vm;
@@ -249,6 +481,19 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     }
   }
 
+  // Commands written into a file need no server: no password, and the
+  // structure of table from the cache
+  if(vm.count("emit-sql"))
+  {
+    emit_sql = vm["emit-sql"].as<string>();
+    offline = true;
+    if("-" == emit_sql)
+    {
+      // Commands only on stdout
+      standard_output = cout.rdbuf(cerr.rdbuf());
+    }
+  }
+
   // Get general parameters used by both OperationTool (also used by
   // SelectionTool)
   try {
@@ -272,8 +517,8 @@ int ArgumentParser::Parse(int argc, const char* argv[])
   }
 
   // Try to acquire the mode
-  string two_modes[] = { "insert-mode", "update-mode", "delete-mode" };
-  for(int i=1;i<3;++i)
+  string two_modes[] = { "insert-mode", "update-mode", "delete-mode", "upsert-mode" };
+  for(int i=1;i<4;++i)
   {
     if(0 == vm.count(two_modes[i].c_str()))
       continue;
@@ -292,27 +537,139 @@ int ArgumentParser::Parse(int argc, const char* argv[])
   // terminal, OperationTool quits.
   separate_tables = vm.count("multi-tables");
 
-  // Ways to give OperationTool the materials to handle
-  if(vm.count("json-file"))
+  // Number of records inserted by one command
+  batch_size = vm["batch-size"].as<int>();
+  if(0 > batch_size)
+  {
+    cerr << "Illegal batch size: " << batch_size << endl;
+    return 2;
+  }
+
+  // Bulk loader works for insertion only
+  bulk_loading = vm.count("bulk-load");
+  if(bulk_loading && insertion_mode != operation_mode)
+  {
+    cerr << "\"bulk-load\" is only for insertion..." << endl;
+    return 2;
+  }
+  preparing = vm.count("prepared");
+  if(preparing && (insertion_mode != operation_mode || bulk_loading))
+  {
+    cerr << "\"prepared\" is only for insertion, without \"bulk-load\"..." << endl;
+    return 2;
+  }
+  bulk_updating = vm.count("bulk-update");
+  if(bulk_updating && updating_mode != operation_mode)
+  {
+    cerr << "\"bulk-update\" is only for updating..." << endl;
+    return 2;
+  }
+  if(vm.count("by-key"))
+    key_deleting = vm.count("verify") ? 2 : 1;
+  else if(vm.count("verify"))
+  {
+    cerr << "\"verify\" works with \"by-key\" only..." << endl;
+    return 2;
+  }
+  if(key_deleting && deletion_mode != operation_mode)
+  {
+    cerr << "\"by-key\" is only for deletion..." << endl;
+    return 2;
+  }
+  replacing = vm.count("replace");
+  if(replacing && upsert_mode != operation_mode)
+  {
+    cerr << "\"replace\" is only for upsert..." << endl;
+    return 2;
+  }
+  connections = vm["connections"].as<int>();
+  if(1 > connections)
+  {
+    cerr << "Illegal number of connections: " << connections << endl;
+    return 2;
+  }
+  // Chunks are committed one by one, which connections committed together
+  // can't allow
+  if(bulk_updating && 1 != connections)
+  {
+    cerr << "\"bulk-update\" works with one connection only..." << endl;
+    return 2;
+  }
+  if(vm.count("stream"))
   {
-    // Use of json-file
-    string json_file(vm["json-file"].as<string>());
-    ifstream in(json_file.c_str());
-    if(!in || !in.is_open())
+    stream_window = vm["stream"].as<int>();
+    if(1 > stream_window || !vm.count("json-file") || 1 != connections)
     {
-      cerr << "Error openning json file |" << json_file << "|..." << endl;
+      cerr << "\"stream\" needs a positive window and \"json-file\", with one connection..." << endl;
       return 2;
     }
-    string line;
-    while(getline(in, line))
+  }
+  skipping_existing = vm.count("skip-existing");
+  if(skipping_existing && insertion_mode != operation_mode)
+  {
+    cerr << "\"skip-existing\" is only for insertion..." << endl;
+    return 2;
+  }
+  // Records are committed in the order of input
+  commit_every = vm["commit-every"].as<int>();
+  if(0 > commit_every)
+  {
+    cerr << "Illegal number of records per commit: " << commit_every << endl;
+    return 2;
+  }
+  if((commit_every || vm.count("resume")) &&
+     (1 != connections || bulk_loading || bulk_updating || key_deleting))
+  {
+    cerr << "\"commit-every\"/\"resume\" work with one connection, without \"bulk-load\", \"bulk-update\" and \"by-key\"..." << endl;
+    return 2;
+  }
+
+  // Records of the table under the directories scanned are brought in line
+  // with the files: new ones inserted, changed ones updated, and those gone
+  // deleted
+  reconciling = vm.count("reconcile");
+  if(reconciling && (!vm.count("scan") || insertion_mode != operation_mode || separate_tables ||
+                     bulk_loading || preparing || skipping_existing || commit_every ||
+                     vm.count("resume") || 1 != connections || offline))
+  {
+    cerr << "\"reconcile\" works with \"scan\" in the default mode and one connection, without \"multi-tables\", \"bulk-load\", \"prepared\", \"skip-existing\", \"commit-every\", \"resume\" and \"emit-sql\"..." << endl;
+    return 2;
+  }
+  if(vm.count("manifest"))
+  {
+    // Without checksums, it would be saved with none
+    if(!vm.count("scan") || !vm.count("scan-checksum"))
     {
-      if(3 > line.size()) break;
-      PropertyParser::GetInstance().ParseJSON(line, holder);
-      line.clear();
+      cerr << "\"manifest\" works with \"scan\" and \"scan-checksum\" only..." << endl;
+      return 2;
     }
-    in.close();
+    manifest = vm["manifest"].as<string>();
+  }
+
+  threads = vm["threads"].as<int>();
+  if(0 > threads)
+  {
+    cerr << "Illegal number of threads: " << threads << endl;
+    return 2;
+  }
+
+  // Ways to give OperationTool the materials to handle
+  if(vm.count("json-file"))
+  {
+    // Use of json-file(s), parsed now, or while streaming
+    if(!ExpandJSONFiles(vm["json-file"].as<vector<string> >()))
+      return 2;
+    if(!stream_window && !IngestJSONFiles())
+      return 2;
     terminal_mode = ArgumentParser::json_file;
   }
+  else if(vm.count("scan"))
+  {
+    // Records from the file system
+    if(!IngestScannedFiles(vm["scan"].as<vector<string> >(), vm["lfn-prefix"].as<string>(), vm.count("scan-checksum")))
+      return 2;
+    terminal_mode = scanned_files;
+  }
   else if(vm.count("direct-input"))
   {
     // Materials will be input interactively (or use pipeline or something)
@@ -364,120 +721,836 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     }
   }
 
+  // Journal of committed records
+  if(vm.count("journal"))
+    journal = vm["journal"].as<string>();
+  else if(!json_files.empty())
+    journal = json_files.front() + ".journal";
+  else
+    journal = "TwoTools.journal";
+  if(vm.count("resume") && !ReadJournal())
+    return 2;
+
+  // Commands written are sent as they are: nothing is looked up
+  if(offline && (bulk_loading || bulk_updating || key_deleting || preparing || skipping_existing ||
+                 1 != connections || vm.count("resume")))
+  {
+    cerr << "\"emit-sql\" works with one connection, without \"bulk-load\", \"bulk-update\", \"by-key\", \"prepared\", \"skip-existing\" and \"resume\"..." << endl;
+    return 2;
+  }
+
   return 0;
 }
 
-// Direct input...
-bool ArgumentParser::IngestDirectInput()
+// The input, by names of JSON files, or how records were given
+string ArgumentParser::InputOfJournal() const
 {
-  string line;
-  map<string, string> one_record;
+  if(!json_files.empty())
+    return boost::join(json_files, " ");
+  else if(direct_input == terminal_mode)
+    return "(direct input)";
+  else if(scanned_files == terminal_mode)
+    return "(scanned files)";
+  else
+    return "(options)";
+}
 
-  // Use a blank line to terminate. Signal Ctrl + D also works (can break this
-  // loop).
-  while(getline(cin, line))
+// Read the journal. Each line: <key>\t<value>, for keys:
+//   input: see InputOfJournal
+//   table: name of table
+//   window: "stream" window (0 without), since repeated records are dropped
+//           in each window: positions are counted differently by another
+//   committed: number of records committed
+bool ArgumentParser::ReadJournal()
+{
+  ifstream in(journal.c_str());
+  if(!in.is_open())
   {
-    if(line.size() < 2)
-      break;
-
-    // Each pair of (<aspect>, <value>) is transferred to "InsertMap" to get
-    // parsed.
-    if(string::npos != line.find(";") || string::npos != line.find(","))
-    {
-      // A line with multiple aspects
-      vector<string> contents;
-      boost::split(contents, line, boost::is_any_of(";,"), boost::token_compress_on);
-      for(vector<string>::iterator it = contents.begin(); it != contents.end(); ++it)
-        InsertMap(*it, one_record);
-    }
-    else
-      InsertMap(line, one_record);
-
-    line.clear();
+    cerr << "Can't open the journal |" << journal << "|..." << endl;
+    return false;
   }
 
-  if(one_record.end() == one_record.find("lfn"))
+  map<string, string> items;
+  string line;
+  while(getline(in, line))
   {
-    cerr << "No LFN found in the JSON string |" << line << "|..." << endl;
+    size_t tab = line.find('\t');
+    if(string::npos != tab)
+      items[line.substr(0, tab)] = line.substr(tab + 1);
+  }
+  if(items["input"] != InputOfJournal() || items["table"] != Table())
+  {
+    cerr << "The journal |" << journal << "| is of |" << items["input"] << "| into |" << items["table"] << "|, not this run..." << endl;
     return false;
   }
-  else
+  ostringstream window;
+  window << stream_window;
+  if(items["window"] != window.str())
   {
-    PropertyParser::GetInstance().ParseString(one_record, holder);
-    return true;
+    cerr << "The journal |" << journal << "| is of a stream window of |" << items["window"] << "| (0: no \"stream\"), not "
+         << stream_window << ": records are counted differently..." << endl;
+    return false;
   }
+  resume_from = strtoul(items["committed"].c_str(), 0, 10);
+  cout << "Resuming after " << resume_from << " committed record(s)..." << endl;
+  return true;
 }
 
-// Insert into the key-value container. This container as a whole is a record.
-void ArgumentParser::InsertMap(const string& content, map<string, string>& target) const
+// Save the journal
+bool ArgumentParser::WriteJournal(size_t committed) const
 {
-  if(content.empty())
-    return;
+  ostringstream out;
+  out << "input\t" << InputOfJournal() << '\n';
+  out << "table\t" << Table() << '\n';
+  out << "window\t" << stream_window << '\n';
+  out << "committed\t" << committed << '\n';
+  if(WriteFileAtomically(journal, out.str()))
+    return true;
+  cerr << "\033[31mWarning... Can't save the journal |" << journal << "| (" << committed << " committed)...\033[0m" << endl;
+  return false;
+}
 
-  string line(content);
-  // Replace single quotes with double ones.
-  if(string::npos != line.find("'"))
-    boost::replace_all(line, "'", "\"");
+// ===> JSONChunkParser <===
+// Parse chunks (of whole lines) of a JSON file in background
+#include <glob.h>
+#include <unistd.h>
+namespace {
+  class JSONChunkParser: public BackgroundTask {
+    // [begin, end) of each chunk
+    const vector<pair<const char*, const char*> >& chunks;
+    // Records of each chunk
+    vector<RecordsHolder>& holders;
+    // Chunks parsed by this one: <first>, <first> + <step>, ...
+    const size_t first;
+    const size_t step;
+  public:
+    JSONChunkParser(const vector<pair<const char*, const char*> >& c, vector<RecordsHolder>& h, size_t f, size_t s):
+      chunks(c), holders(h), first(f), step(s)
+    {}
+    ~JSONChunkParser() { Join(); }
 
-  // Find the separator used by this pair to separate aspect and value.
-  int found = -1;
-  for(int i=0;i<sizeof(separators)/sizeof(separators[0]);++i)
-  {
-    if(string::npos != line.find(separators[i]))
+    void Run()
     {
-      if(-1 != found && 4 != i && 0 == found)
+      for(size_t i=first;i<chunks.size();i+=step)
       {
-        cout << "Multiple separators found (Before: " <<
-                separators[found] << "; Now: " << separators[i] << endl;
+        const char* it = chunks[i].first;
+        while(it < chunks[i].second)
+        {
+          const char* end_of_line = static_cast<const char*>(memchr(it, '\n', chunks[i].second - it));
+          if(!end_of_line)
+            end_of_line = chunks[i].second;
+          // Blank lines skipped
+          if(end_of_line - it >= 3)
+            PropertyParser::GetInstance().ParseJSON(it, end_of_line, holders[i]);
+          it = end_of_line + 1;
+        }
       }
-      found = i;
     }
-  }
-  if(-1 == found)
-  {
-    // No separator matches. Can't extract aspects nor values
-    cout << "Warning... No column specified from |" << line << "|..." << endl;
-    return;
-  }
+  };
+}
 
-  // Separate aspect and value
-  string second = line.substr(line.find(separators[found]) + separators[found].size());
-  string first = line.substr(0, line.find(separators[found]));
-  if(second.empty())
+// Names of JSON files, from names or patterns to match them
+bool ArgumentParser::ExpandJSONFiles(const vector<string>& patterns)
+{
+  json_files.clear();
+  for(size_t i=0;i<patterns.size();++i)
   {
-    cout << "Empty data on " << first << endl;
-    return;
+    glob_t matched;
+    if(glob(patterns[i].c_str(), GLOB_NOCHECK, 0, &matched))
+    {
+      cerr << "Error matching |" << patterns[i] << "|..." << endl;
+      return false;
+    }
+    for(size_t j=0;j<matched.gl_pathc;++j)
+      json_files.push_back(matched.gl_pathv[j]);
+    globfree(&matched);
   }
+  return true;
+}
 
-  if(found)
-  {
-    boost::erase_all(first, "\"");
-    boost::erase_all(second, "\"");
-  }
-  // To remove leading and tailing whitespaces
-  boost::trim(first);
-  boost::trim(second);
+// Number of threads to start
+size_t ArgumentParser::WorkerThreads() const
+{
+  if(threads)
+    return threads;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? cores : 1;
+}
 
-  if(target.end() != target.find(first))
+// Parse JSON files: each file is cut into chunks of lines parsed by
+// <threads> threads, and records are merged in their order in the file.
+bool ArgumentParser::IngestJSONFiles()
+{
+
+  size_t N_threads = WorkerThreads();
+  int index_of_lfn = PropertyParser::GetInstance().GetIndex("lfn");
+
+  for(size_t i=0;i<json_files.size();++i)
   {
-    cout << "Overwritting item of " << first << " (" << target[first] << ") with " << second;
-    target[first].assign(second);
-  }
-  else
-    target.insert(make_pair(first, second));
-}
+    // Lines are parsed where they are in the mapping, or, if the file can't
+    // be mapped (e.g. a pipe), in a copy of it
+    MappedFile content;
+    string copied;
+    if(!content.Open(json_files[i]))
+    {
+      ifstream in(json_files[i].c_str(), ios::binary);
+      if(!in || !in.is_open())
+      {
+        cerr << "Error openning json file |" << json_files[i] << "|..." << endl;
+        return false;
+      }
+      ostringstream buffer;
+      buffer << in.rdbuf();
+      copied.assign(buffer.str());
+    }
+    const char* begin = content.Size() ? content.Begin() : copied.data();
+    const char* end = content.Size() ? content.End() : copied.data() + copied.size();
+    if(begin == end)
+      continue;
 
-// Allowed separators of JSON string
-const string ArgumentParser::separators[] = {"=", "\": \"", "\":\"", "\" :\"", "\" : \"", "\": "};
+    // Chunks of about the same size, cut at the end of lines. More chunks
+    // than threads, so that one slow chunk doesn't hold the others.
+    vector<pair<const char*, const char*> > chunks;
+    size_t chunk_size = (end - begin) / (N_threads * 4) + 1;
+    for(const char* it = begin; it < end;)
+    {
+      const char* stop = size_t(end - it) > chunk_size ? it + chunk_size : end;
+      stop = static_cast<const char*>(memchr(stop - 1, '\n', end - stop + 1));
+      stop = stop ? stop + 1 : end;
+      chunks.push_back(make_pair(it, stop));
+      it = stop;
+    }
 
+    vector<RecordsHolder> holders(chunks.size());
+    for(size_t j=0;j<holders.size();++j)
+      holders[j].DetectDuplicates(false);
+    size_t N_workers = N_threads < chunks.size() ? N_threads : chunks.size();
+    if(1 == N_workers)
+      JSONChunkParser(chunks, holders, 0, 1).Run();
+    else
+    {
+      vector<JSONChunkParser*> workers;
+      for(size_t j=0;j<N_workers;++j)
+      {
+        workers.push_back(new JSONChunkParser(chunks, holders, j, N_workers));
+        workers.back()->Start();
+      }
+      for(size_t j=0;j<N_workers;++j)
+        delete workers[j];	// Joined
+    }
 
-// ===> OperationTool::BaseCommand <===
-// Generates the forewords (column names) for MySQL queries
+    // Repeated records are detected here, in the order of input
+    for(size_t j=0;j<holders.size();++j)
+      holder.Insert(holders[j], index_of_lfn);
+  }
+
+  return true;
+}
+
+// ===> MD5 <===
+// MD5 digest (RFC 1321), as the checksums of ROOT files are
+#include <stdint.h>
+namespace {
+  class MD5 {
+    uint32_t state[4];
+    // Number of bytes digested
+    uint64_t length;
+    // Bytes waiting for a whole block
+    unsigned char block[64];
+  public:
+    MD5(): length(0)
+    {
+      state[0] = 0x67452301;
+      state[1] = 0xefcdab89;
+      state[2] = 0x98badcfe;
+      state[3] = 0x10325476;
+    }
+
+    void Update(const char* data, size_t size)
+    {
+      const unsigned char* it = reinterpret_cast<const unsigned char*>(data);
+      size_t waiting = length % 64;
+      length += size;
+      if(waiting)
+      {
+        size_t taken = 64 - waiting < size ? 64 - waiting : size;
+        memcpy(block + waiting, it, taken);
+        it += taken;
+        size -= taken;
+        if(waiting + taken < 64)
+          return;
+        Transform(block);
+      }
+      for(;size >= 64;it += 64, size -= 64)
+        Transform(it);
+      memcpy(block, it, size);
+    }
+
+    // 32 hexadecimal digits
+    string HexDigest()
+    {
+      uint64_t bits = length * 8;
+      unsigned char padding[72] = {0x80};
+      size_t waiting = length % 64;
+      Update(reinterpret_cast<const char*>(padding), (waiting < 56 ? 56 : 120) - waiting);
+      unsigned char size[8];
+      for(int i=0;i<8;++i)
+        size[i] = (bits >> (8 * i)) & 0xff;
+      Update(reinterpret_cast<const char*>(size), 8);
+
+      static const char digits[] = "0123456789abcdef";
+      string hex;
+      for(int i=0;i<16;++i)
+      {
+        unsigned char byte = (state[i/4] >> (8 * (i%4))) & 0xff;
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0xf]);
+      }
+      return hex;
+    }
+
+  private:
+    static uint32_t Rotate(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+    void Transform(const unsigned char* data)
+    {
+      static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+      };
+      static const int S[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+      uint32_t M[16];
+      for(int i=0;i<16;++i)
+        M[i] = data[4*i] | (data[4*i+1] << 8) | (data[4*i+2] << 16) | (uint32_t(data[4*i+3]) << 24);
+
+      uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+      for(int i=0;i<64;++i)
+      {
+        uint32_t f;
+        int g;
+        if(i < 16)      { f = (b & c) | (~b & d); g = i; }
+        else if(i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; }
+        else if(i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) % 16; }
+        else            { f = c ^ (b | ~d);       g = (7 * i) % 16; }
+        uint32_t next = d;
+        d = c;
+        c = b;
+        b = b + Rotate(a + f + K[i] + M[g], S[(i / 16) * 4 + i % 4]);
+        a = next;
+      }
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+    }
+  };
+}
+
+// ===> FileScanner <===
+// Walk directory trees for ROOT files, by a pool of threads stealing work
+// (directories to read, files to hash) from each other
+#include <dirent.h>
+#include <sys/stat.h>
+#include <deque>
+namespace {
+  // A ROOT file found
+  struct ScannedFile {
+    string path;
+    string size;
+    string last_modified;
+    string checksum;
+    // As from "stat", to tell whether a file changed since the manifest
+    off_t bytes;
+    time_t modified;
+    bool operator<(const ScannedFile& other) const { return path < other.path; }
+  };
+
+  class FileScanner {
+  public:
+    // A directory to read, or a file to hash
+    struct Task {
+      string path;
+      bool directory;
+      // Of a file
+      off_t size;
+      time_t modified;
+      // Of a directory: (device, inode) of those above it, to find loops
+      // made by symbolic links
+      vector<pair<dev_t, ino_t> > ancestors;
+    };
+  private:
+    class Worker: public BackgroundTask {
+      FileScanner& scanner;
+      const size_t index;
+    public:
+      // Own tasks, taken from the back (by itself) or the front (by others)
+      deque<Task> tasks;
+      pthread_mutex_t lock;
+      // Files found by this worker
+      vector<ScannedFile> found;
+      // Number of files hashed (rather than taken from the manifest)
+      size_t hashed;
+      // Number of directories (or files to hash) that can't be read
+      size_t unreadable;
+
+      Worker(FileScanner& s, size_t i): scanner(s), index(i), hashed(0), unreadable(0)
+      { pthread_mutex_init(&lock, 0); }
+      ~Worker()
+      {
+        Join();
+        pthread_mutex_destroy(&lock);
+      }
+    protected:
+      void Run() { scanner.Work(index); }
+    };
+
+    const bool hashing;
+    // Files of the manifest, by path, whose checksums are kept if unchanged
+    const map<string, ScannedFile>& known;
+    vector<Worker*> workers;
+    // Tasks waiting in any queue, and tasks not finished (waiting or running)
+    size_t queued;
+    size_t pending;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+  public:
+    FileScanner(size_t N_threads, bool h, const map<string, ScannedFile>& k): hashing(h), known(k), queued(0), pending(0)
+    {
+      pthread_mutex_init(&lock, 0);
+      pthread_cond_init(&changed, 0);
+      for(size_t i=0;i<N_threads;++i)
+        workers.push_back(new Worker(*this, i));
+    }
+    ~FileScanner()
+    {
+      for(size_t i=0;i<workers.size();++i)
+        delete workers[i];
+      pthread_cond_destroy(&changed);
+      pthread_mutex_destroy(&lock);
+    }
+
+    // Walk <directories>, and return all ROOT files found, by path, with the
+    // number of files hashed, and of those (directories or files) unreadable
+    void Scan(const vector<string>& directories, vector<ScannedFile>& files, size_t& N_hashed, size_t& N_unreadable)
+    {
+      for(size_t i=0;i<directories.size();++i)
+      {
+        Task task;
+        task.path = directories[i];
+        task.directory = true;
+        Push(i % workers.size(), task);
+      }
+      for(size_t i=0;i<workers.size();++i)
+        workers[i]->Start();
+      files.clear();
+      N_hashed = N_unreadable = 0;
+      for(size_t i=0;i<workers.size();++i)
+      {
+        workers[i]->Join();
+        files.insert(files.end(), workers[i]->found.begin(), workers[i]->found.end());
+        N_hashed += workers[i]->hashed;
+        N_unreadable += workers[i]->unreadable;
+      }
+      sort(files.begin(), files.end());
+    }
+
+  private:
+    void Push(size_t index, const Task& task)
+    {
+      // Counted before it is published: otherwise a worker may take it and
+      // count it down first, and the others see all done
+      pthread_mutex_lock(&lock);
+      ++queued;
+      ++pending;
+      pthread_mutex_unlock(&lock);
+      Worker& worker = *workers[index];
+      pthread_mutex_lock(&worker.lock);
+      worker.tasks.push_back(task);
+      pthread_mutex_unlock(&worker.lock);
+      pthread_mutex_lock(&lock);
+      pthread_cond_signal(&changed);
+      pthread_mutex_unlock(&lock);
+    }
+
+    // A task of its own (the latest), or one stolen from others (the oldest)
+    bool Take(size_t index, Task& task)
+    {
+      for(size_t i=0;i<workers.size();++i)
+      {
+        Worker& worker = *workers[(index + i) % workers.size()];
+        pthread_mutex_lock(&worker.lock);
+        bool taken = !worker.tasks.empty();
+        if(taken && 0 == i)
+        {
+          task = worker.tasks.back();
+          worker.tasks.pop_back();
+        }
+        else if(taken)
+        {
+          task = worker.tasks.front();
+          worker.tasks.pop_front();
+        }
+        pthread_mutex_unlock(&worker.lock);
+        if(taken)
+        {
+          pthread_mutex_lock(&lock);
+          --queued;
+          pthread_mutex_unlock(&lock);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void Work(size_t index)
+    {
+      Task task;
+      while(true)
+      {
+        if(Take(index, task))
+        {
+          if(task.directory)
+            ReadDirectory(index, task);
+          else
+            Found(index, task);
+          pthread_mutex_lock(&lock);
+          if(0 == --pending)
+            pthread_cond_broadcast(&changed);
+          pthread_mutex_unlock(&lock);
+          continue;
+        }
+
+        // Wait for new tasks, or for all to finish
+        pthread_mutex_lock(&lock);
+        while(0 == queued && 0 != pending)
+          pthread_cond_wait(&changed, &lock);
+        bool finished = (0 == pending);
+        pthread_mutex_unlock(&lock);
+        if(finished)
+          return;
+      }
+    }
+
+    // Sub-directories are new tasks, and so are ROOT files to hash.
+    // Symbolic links are followed, as files of their own path.
+    void ReadDirectory(size_t index, const Task& parent)
+    {
+      const string& path = parent.path;
+      DIR* directory = opendir(path.c_str());
+      if(!directory)
+      {
+        cerr << "Warning... Can't read directory |" << path << "|..." << endl;
+        ++workers[index]->unreadable;
+        return;
+      }
+      struct stat status;
+      vector<pair<dev_t, ino_t> > ancestors(parent.ancestors);
+      if(0 == fstat(dirfd(directory), &status))
+      {
+        // Reached again under itself by a link: walked already
+        pair<dev_t, ino_t> itself(status.st_dev, status.st_ino);
+        if(ancestors.end() != find(ancestors.begin(), ancestors.end(), itself))
+        {
+          cerr << "Warning... |" << path << "| links to a directory above it, skipped..." << endl;
+          closedir(directory);
+          return;
+        }
+        ancestors.push_back(itself);
+      }
+      string prefix(boost::ends_with(path, "/") ? path : path + "/");
+      dirent* entry;
+      while((entry = readdir(directory)))
+      {
+        string name(entry->d_name);
+        if("." == name || ".." == name)
+          continue;
+        Task task;
+        task.path = prefix + name;
+        if(stat(task.path.c_str(), &status))
+        {
+          // A link to nothing is no file, others may hide files
+          struct stat link;
+          if(0 == lstat(task.path.c_str(), &link) && S_ISLNK(link.st_mode))
+            cerr << "Warning... |" << task.path << "| links to nothing, skipped..." << endl;
+          else
+          {
+            cerr << "Warning... Can't stat |" << task.path << "|..." << endl;
+            ++workers[index]->unreadable;
+          }
+          continue;
+        }
+        if(S_ISDIR(status.st_mode))
+        {
+          task.directory = true;
+          task.ancestors = ancestors;
+          Push(index, task);
+        }
+        else if(S_ISREG(status.st_mode) && boost::ends_with(name, ".root"))
+        {
+          task.directory = false;
+          task.size = status.st_size;
+          task.modified = status.st_mtime;
+          if(hashing)
+            Push(index, task);	// May be taken by an idle worker
+          else
+            Found(index, task);
+        }
+      }
+      closedir(directory);
+    }
+
+    void Found(size_t index, const Task& task)
+    {
+      ScannedFile file;
+      file.path = task.path;
+      file.bytes = task.size;
+      file.modified = task.modified;
+      ostringstream size;
+      size << task.size;
+      file.size = size.str();
+      struct tm modified;
+      localtime_r(&task.modified, &modified);
+      char time_string[24] = {'\0'};
+      strftime(time_string, sizeof(time_string), "%Y-%m-%d_%H:%M:%S", &modified);
+      file.last_modified = time_string;
+
+      // Unchanged since the manifest: the same content
+      map<string, ScannedFile>::const_iterator before = known.find(task.path);
+      if(hashing && known.end() != before && before->second.bytes == task.size &&
+         before->second.modified == task.modified && !before->second.checksum.empty())
+        file.checksum = before->second.checksum;
+      else if(hashing)
+      {
+        MappedFile content;
+        if(!content.Open(task.path))
+        {
+          cerr << "Warning... Can't read |" << task.path << "|, skipped..." << endl;
+          ++workers[index]->unreadable;
+          return;
+        }
+        MD5 digest;
+        digest.Update(content.Begin(), content.Size());
+        file.checksum = digest.HexDigest();
+        ++workers[index]->hashed;
+      }
+      workers[index]->found.push_back(file);
+    }
+  };
+}
+
+// Manifest of files scanned: a line for a file, of its path, size, time of
+// last modification (seconds since the epoch) and checksum, split by tabs
+namespace {
+  void ReadManifest(const string& name, map<string, ScannedFile>& known)
+  {
+    ifstream in(name.c_str());
+    if(!in.is_open())
+    {
+      cout << "No manifest |" << name << "| yet, all files hashed..." << endl;
+      return;
+    }
+    string line;
+    vector<string> fields;
+    while(getline(in, line))
+    {
+      boost::split(fields, line, boost::is_any_of("\t"));
+      if(4 != fields.size())
+        continue;
+      ScannedFile& file = known[fields[0]];
+      file.path = fields[0];
+      file.bytes = strtoll(fields[1].c_str(), 0, 10);
+      file.modified = strtoll(fields[2].c_str(), 0, 10);
+      file.checksum = fields[3];
+    }
+  }
+
+  bool WriteManifest(const string& name, const vector<ScannedFile>& files)
+  {
+    ostringstream out;
+    for(size_t i=0;i<files.size();++i)
+      out << files[i].path << '\t' << files[i].bytes << '\t' << files[i].modified << '\t' << files[i].checksum << '\n';
+    if(WriteFileAtomically(name, out.str()))
+      return true;
+    cerr << "\033[31mWarning... Can't save the manifest |" << name << "|...\033[0m" << endl;
+    return false;
+  }
+}
+
+// Records of ROOT files in <directories>: lfn (<prefix> + path), size and
+// last_modified (and checksum with <hashing>), from the file system
+bool ArgumentParser::IngestScannedFiles(const vector<string>& directories, const string& prefix, bool hashing)
+{
+  size_t N_threads = WorkerThreads();
+
+  // Checksums of files unchanged since the last scan are kept
+  map<string, ScannedFile> known;
+  if(hashing && !manifest.empty())
+    ReadManifest(manifest, known);
+
+  vector<ScannedFile> files;
+  size_t N_hashed = 0;
+  size_t N_unreadable = 0;
+  {
+    FileScanner scanner(N_threads, hashing, known);
+    scanner.Scan(directories, files, N_hashed, N_unreadable);
+  }
+  // Nothing left in the directories: all their records are deleted
+  if(files.empty() && !reconciling)
+  {
+    cerr << "No ROOT file found in |" << boost::join(directories, " ") << "|..." << endl;
+    return false;
+  }
+  cout << files.size() << " ROOT file(s) found";
+  if(hashing)
+    cout << ", " << N_hashed << " hashed";
+  cout << "..." << endl;
+  // Records of files missed would be deleted
+  if(reconciling && N_unreadable)
+  {
+    cerr << N_unreadable << " director" << (N_unreadable>1?"ies or files":"y or file") << " can't be read, nothing reconciled..." << endl;
+    return false;
+  }
+  if(hashing && !manifest.empty())
+    WriteManifest(manifest, files);
+
+  // LFNs of the directories, for records listed from the table
+  for(size_t i=0;i<directories.size();++i)
+    scanned_roots.push_back(prefix + directories[i] + (boost::ends_with(directories[i], "/") ? "" : "/"));
+
+  holder.Reserve(files.size());
+  map<string, string> record;
+  for(size_t i=0;i<files.size();++i)
+  {
+    record["lfn"] = prefix + files[i].path;
+    record["size"] = files[i].size;
+    record["last_modified"] = files[i].last_modified;
+    if(hashing)
+      record["checksum"] = files[i].checksum;
+    PropertyParser::GetInstance().ParseString(record, holder);
+  }
+  return true;
+}
+
+// Direct input...
+bool ArgumentParser::IngestDirectInput()
+{
+  string line;
+  map<string, string> one_record;
+
+  // Use a blank line to terminate. Signal Ctrl + D also works (can break this
+  // loop).
+  while(getline(cin, line))
+  {
+    if(line.size() < 2)
+      break;
+
+    // Each pair of (<aspect>, <value>) is transferred to "InsertMap" to get
+    // parsed.
+    if(string::npos != line.find(";") || string::npos != line.find(","))
+    {
+      // A line with multiple aspects
+      vector<string> contents;
+      boost::split(contents, line, boost::is_any_of(";,"), boost::token_compress_on);
+      for(vector<string>::iterator it = contents.begin(); it != contents.end(); ++it)
+        InsertMap(*it, one_record);
+    }
+    else
+      InsertMap(line, one_record);
+
+    line.clear();
+  }
+
+  if(one_record.end() == one_record.find("lfn"))
+  {
+    cerr << "No LFN found in the JSON string |" << line << "|..." << endl;
+    return false;
+  }
+  else
+  {
+    PropertyParser::GetInstance().ParseString(one_record, holder);
+    return true;
+  }
+}
+
+// Insert into the key-value container. This container as a whole is a record.
+void ArgumentParser::InsertMap(const string& content, map<string, string>& target) const
+{
+  if(content.empty())
+    return;
+
+  string line(content);
+  // Replace single quotes with double ones.
+  if(string::npos != line.find("'"))
+    boost::replace_all(line, "'", "\"");
+
+  // Find the separator used by this pair to separate aspect and value.
+  int found = -1;
+  for(int i=0;i<sizeof(separators)/sizeof(separators[0]);++i)
+  {
+    if(string::npos != line.find(separators[i]))
+    {
+      if(-1 != found && 4 != i && 0 == found)
+      {
+        cout << "Multiple separators found (Before: " <<
+                separators[found] << "; Now: " << separators[i] << endl;
+      }
+      found = i;
+    }
+  }
+  if(-1 == found)
+  {
+    // No separator matches. Can't extract aspects nor values
+    cout << "Warning... No column specified from |" << line << "|..." << endl;
+    return;
+  }
+
+  // Separate aspect and value
+  string second = line.substr(line.find(separators[found]) + separators[found].size());
+  string first = line.substr(0, line.find(separators[found]));
+  if(second.empty())
+  {
+    cout << "Empty data on " << first << endl;
+    return;
+  }
+
+  if(found)
+  {
+    boost::erase_all(first, "\"");
+    boost::erase_all(second, "\"");
+  }
+  // To remove leading and tailing whitespaces
+  boost::trim(first);
+  boost::trim(second);
+
+  if(target.end() != target.find(first))
+  {
+    cout << "Overwritting item of " << first << " (" << target[first] << ") with " << second;
+    target[first].assign(second);
+  }
+  else
+    target.insert(make_pair(first, second));
+}
+
+// Allowed separators of JSON string
+const string ArgumentParser::separators[] = {"=", "\": \"", "\":\"", "\" :\"", "\" : \"", "\": "};
+
+
+// ===> OperationTool::BaseCommand <===
+// Generates the forewords (column names) for MySQL queries
 // Locate the index of LFN, hints to find the table
-// Need 2 arguments:
+// Need 3 arguments:
 //   1. ArgumentParser
 //   2. indexes of wanted columns among all columns (to avoid NULL)
-OperationTool::BaseCommand::BaseCommand(const ArgumentParser& parser, const vector<int>& wanted):
+//   3. connection escaping values (by hand if none)
+OperationTool::BaseCommand::BaseCommand(const ArgumentParser& parser, const vector<int>& wanted, MySQLInterface* connection):
   creation_time(GetTime()),
   data_2a_tbl("data_2a_tbl"),
   mc_simu_tbl("mc_simu_tbl"),
@@ -485,7 +1558,9 @@ OperationTool::BaseCommand::BaseCommand(const ArgumentParser& parser, const vect
   index_of_lfn(-1),
   different_tables(false),
   number_of_columns_for_query(parser.N_Columns()),
-  columns_for_query(number_of_columns_for_query)
+  columns_for_query(number_of_columns_for_query),
+  indexes_for_query(number_of_columns_for_query, -1),
+  builder(connection)
 {
   vector<string> column_names;	// List of names of columns
   parser.Columns(column_names);
@@ -508,6 +1583,7 @@ OperationTool::BaseCommand::BaseCommand(const ArgumentParser& parser, const vect
         index_of_lfn = i;
       }
       columns_for_query[i].assign(one_column);
+      indexes_for_query[i] = i;
     }
   }
   else
@@ -523,6 +1599,7 @@ OperationTool::BaseCommand::BaseCommand(const ArgumentParser& parser, const vect
         index_of_lfn = wanted[i];
       }
       columns_for_query[i].assign(one_column);
+      indexes_for_query[i] = wanted[i];
     }
   }
 
@@ -579,9 +1656,10 @@ string OperationTool::BaseCommand::GetTime() const
 {
   time_t rawtime;
   time(&rawtime);
-  struct tm * timeinfo = localtime(&rawtime);
+  struct tm timeinfo;
+  localtime_r(&rawtime, &timeinfo);	// Commands may be made in threads
   char str[20] = {'\0'};
-  strftime(str, 16, "%Y%m%d_%H%M%S", timeinfo);
+  strftime(str, 16, "%Y%m%d_%H%M%S", &timeinfo);
   return str;
 }
 
@@ -601,25 +1679,37 @@ string OperationTool::BaseCommand::FindTable(const vector<string>& one_record) c
     return string();
 }
 
-// Testing if the table of the record presented by <one_record> matches
-// Need 2 arguments:
-//   1. a record (an aspect as an element)
-//   2. MySQL query command for this record
-// Returns true if accepted (table from terminal and table of this record
-// match, or different tables are allowed), false otherwise
-bool OperationTool::BaseCommand::BasicCommand(const vector<string>& one_record, string& command) const
+// The table for the command of the record <one_record>, which shall have all
+// columns. BadCommand is thrown if it is rejected (see TableOf).
+string OperationTool::BaseCommand::TableOfCommand(const vector<string>& one_record) const throw(BadCommand)
+{
+  if(one_record.size() != number_of_columns_for_query)
+  {
+    cout << "Warning! Number of columns doesn't match! " << one_record.size() << " from record while " << columns_for_query.size() << " internally." << endl;
+    throw BadCommand();
+  }
+
+  string name_of_table(TableOf(one_record));
+  if(name_of_table.empty())
+    throw BadCommand();
+  return name_of_table;
+}
+
+// Find the table of the record <one_record>
+// Returns the name of table if accepted, empty string otherwise
+string OperationTool::BaseCommand::TableOf(const vector<string>& one_record) const
 {
   if(one_record.empty())
   {
     cout << "Nothing from the source..." << endl;
-    return false;
+    return string();
   }
 
   string name_of_table(FindTable(one_record));
   if(name_of_table.empty())
   {
     cout << "No table found." << endl;
-    return false;
+    return string();
   }
 
   if(name_of_table != table)
@@ -629,273 +1719,912 @@ bool OperationTool::BaseCommand::BasicCommand(const vector<string>& one_record,
       cerr << "Warning... Terminal table |" << table << "| and parsed one |" <<
               name_of_table << "| don't match!" << endl;
       cout << "Return with nothing done." << endl;
-      return false;
+      return string();
     }
-    else
-    {
+    else if(other_tables.insert(name_of_table).second)
       cerr << "Warning... Terminal table |" << table << "| and parsed one |" <<
-              name_of_table << "| don't match... Updating..." << endl;
-      boost::replace_all(command, table, name_of_table);
-    }
+              name_of_table << "| don't match... Records routed to it..." << endl;
   }
 
-  return true;
-}
-
-// Modifying the command
-void OperationTool::BaseCommand::CommonModify(string& command) const
-{
-  if(string::npos != command.find("'true'"))
-    boost::replace_all(command, "'true'", "'1'");
-  if(string::npos != command.find("'false'"))
-    boost::replace_all(command, "'false'", "'0'");
+  return name_of_table;
 }
 
 
 // ===> OperationTool::MySQLOperator::InsertionCommand <===
 // Insertion command generator
-OperationTool::InsertionCommand::InsertionCommand(const ArgumentParser& parser, const vector<int>& wanted):
-  BaseCommand(parser, wanted),
-  leading_words("insert into ")	// Common words for querying each record
-{}
+OperationTool::InsertionCommand::InsertionCommand(const ArgumentParser& parser, const vector<int>& wanted, MySQLInterface* connection):
+  BaseCommand(parser, wanted, connection),
+  leading_words("insert into "),	// Common words for querying each record
+  upserting(false)
+{
+  if(ArgumentParser::upsert_mode == parser.OperationMode())
+  {
+    if(parser.Replacing())
+      leading_words.assign("replace into ");
+    else
+      upserting = true;
+  }
+}
 
-// Initiate the database, and prepare the leading_words
+// Initiate the database
 bool OperationTool::InsertionCommand::InitiateDatabase()
 {
-  if(!ValidParameters())
-    return false;
-
-  leading_words.append(table);
-  leading_words.append(" (");
-  leading_words.append(boost::join(columns_for_query, ", "));
-  leading_words.append(") values ('");
-  return true;
+  return ValidParameters();
 }
 
 // Use source, a record, and leading_words, etc., to generate a MySQL query command
-string OperationTool::InsertionCommand::GetCommand(const vector<string>& source) throw(OperationTool::BadCommand)
+// Empty columns of the record are left out.
+const string& OperationTool::InsertionCommand::GetCommand(const vector<string>& source) throw(OperationTool::BadCommand)
 {
-  string one_command(leading_words);
-  if(!BasicCommand(source, one_command))
-    throw BadCommand();
-
-  one_command.append(boost::join(source, "', '"));
-  one_command.append("')");
+  builder.Clear().Append(leading_words).Append(TableOfCommand(source));
 
-  ModifyCommand(one_command);
-
-  return one_command;
-}
+  columns.clear();
+  for(int i=0;i<number_of_columns_for_query;++i)
+  {
+    if(columns_for_query[i].empty() || source[indexes_for_query[i]].empty())
+      continue;
+    if(!columns.empty())
+      columns.append(", ");
+    columns.append(columns_for_query[i]);
+  }
+  builder.Append(" (").Append(columns).Append(") values (");
+  bool first = true;
+  for(int i=0;i<number_of_columns_for_query;++i)
+  {
+    if(columns_for_query[i].empty() || source[indexes_for_query[i]].empty())
+      continue;
+    if(!first)
+      builder.Append(", ");
+    builder.Value(source[indexes_for_query[i]]);
+    first = false;
+  }
+  builder.Append(")");
+
+  // Columns other than LFN are updated for a recorded file
+  if(upserting)
+  {
+    if(columns != last_columns)
+    {
+      last_tail.assign(" on duplicate key update ");
+      for(int i=0;i<number_of_columns_for_query;++i)
+      {
+        const string& name = columns_for_query[i];
+        if(name.empty() || source[indexes_for_query[i]].empty() || "lfn" == name)
+          continue;
+        last_tail.append(name + " = values(" + name + "), ");
+      }
+      boost::erase_last(last_tail, ", ");
+      last_columns.swap(columns);
+    }
+    builder.Append(last_tail);
+  }
+
+  return builder.Command();
+}
 
-// Fix some error induced while modifying MySQL query command
-void OperationTool::InsertionCommand::SpecificModify(string& command) const
+// Head (and tail) of an insertion of many records into <table>
+void OperationTool::InsertionCommand::Head(const string& table, string& head, string& tail) const
 {
-  bool replaced = false;
-  while(string::npos != command.find(", ,"))
+  head.assign(leading_words).append(table).append(" (");
+  tail.clear();
+  bool first = true;
+  for(int i=0;i<number_of_columns_for_query;++i)
   {
-    boost::replace_all(command, ", ,", ",");
-    replaced = true;
+    const string& name = columns_for_query[i];
+    if(name.empty())
+      continue;
+    if(!first)
+      head.append(", ");
+    head.append(name);
+    first = false;
+
+    // Columns other than LFN are updated for a recorded file
+    if(upserting && "lfn" != name)
+      tail.append(tail.empty() ? " on duplicate key update " : ", ").append(name + " = values(" + name + ")");
   }
-  if(replaced)
+  head.append(") values ");
+}
+
+// Values of a record to be joined after the head
+const string& OperationTool::InsertionCommand::Tuple(const vector<string>& source)
+{
+  builder.Clear().Append("(");
+  bool first = true;
+  for(int i=0;i<number_of_columns_for_query;++i)
   {
-    boost::replace_all(command, ", ) values", ") values");
-    boost::erase_all(command, ", ''");
-    boost::erase_all(command, "'', ");
+    if(columns_for_query[i].empty())
+      continue;
+    if(!first)
+      builder.Append(", ");
+    builder.Value(source[indexes_for_query[i]]);
+    first = false;
   }
+  builder.Append(")");
+  return builder.Command();
 }
 
 
 // ===> OperationTool::UpdatingCommand <===
 // Update command generator
-OperationTool::UpdatingCommand::UpdatingCommand(const ArgumentParser& parser, const vector<int>& wanted):
-  BaseCommand(parser, wanted),
+OperationTool::UpdatingCommand::UpdatingCommand(const ArgumentParser& parser, const vector<int>& wanted, MySQLInterface* connection):
+  BaseCommand(parser, wanted, connection),
   leading_words_1("update "),
-  leading_words_2(" where lfn = '")
+  leading_words_2(" where lfn = ")
 { }
 
-// Initiate the database, and prepare the leading_words
+// Initiate the database
 bool OperationTool::UpdatingCommand::InitiateDatabase()
 {
-  if(!ValidParameters())
-    return false;
-
-  leading_words_1.append(table);
-  leading_words_1.append(" set ");
-  return true;
+  return ValidParameters();
 }
 
 // Use source, a record, and leading_words, etc., to generate a MySQL query command
-string OperationTool::UpdatingCommand::GetCommand(const vector<string>& source) throw(BadCommand)
+// Empty columns of the record are left as they are.
+const string& OperationTool::UpdatingCommand::GetCommand(const vector<string>& source) throw(BadCommand)
 {
-  if(source.size() != number_of_columns_for_query)
-  {
-    cout << "Warning! Number of columns doesn't match! " << source.size() << " from record while " << columns_for_query.size() << " internally." << endl;
-    throw BadCommand();
-  }
-
-  string one_command(leading_words_1);
-  if(!BasicCommand(source, one_command))
-    throw BadCommand();
+  builder.Clear().Append(leading_words_1).Append(TableOfCommand(source)).Append(" set ");
 
+  bool first = true;
   for(int i=0;i<number_of_columns_for_query;++i)
   {
-    if(columns_for_query[i].empty())
-      continue;
-
-    int index_of_this_column = PropertyParser::GetInstance().GetIndex(columns_for_query[i]);
-    if(-1 == index_of_this_column || index_of_this_column == index_of_lfn)
+    int index_of_this_column = indexes_for_query[i];
+    if(columns_for_query[i].empty() || index_of_this_column == index_of_lfn ||
+       source[index_of_this_column].empty())
       continue;
-    one_command.append(columns_for_query[i]);
-    if(source[index_of_this_column].empty())
-      one_command.append(" is NULL, ");
-    else
-    {
-      one_command.append(" = '");
-      one_command.append(source[index_of_this_column]);
-      one_command.append("', ");
-    }
+    if(!first)
+      builder.Append(", ");
+    builder.Append(columns_for_query[i]).Append(" = ").Value(source[index_of_this_column]);
+    first = false;
+  }
+  if(first)
+  {
+    cout << "Warning... Nothing to update for |" << source[index_of_lfn] << "|..." << endl;
+    throw BadCommand();
   }
-  boost::erase_last(one_command, ", ");
-
-  one_command.append(leading_words_2);
-  one_command.append(source[index_of_lfn]);
-  one_command.append("'");
 
-  ModifyCommand(one_command);
+  builder.Append(leading_words_2).Value(source[index_of_lfn]);
 
-//cout << "Updating command: |" << one_command << "|." << endl;
-  return one_command;
+//cout << "Updating command: |" << builder.Command() << "|." << endl;
+  return builder.Command();
 }
 
-void OperationTool::UpdatingCommand::SpecificModify(string& command) const
-{ }
-
 
 // ===> OperationTool::DeletionCommand <===
 // Delete command generator
-OperationTool::DeletionCommand::DeletionCommand(const ArgumentParser& parser, const vector<int>& wanted):
-  BaseCommand(parser, wanted),
+OperationTool::DeletionCommand::DeletionCommand(const ArgumentParser& parser, const vector<int>& wanted, MySQLInterface* connection):
+  BaseCommand(parser, wanted, connection),
   leading_words("delete from ")
 { }
 
-// Initiate the database, and prepare the leading_words
+// Initiate the database
 bool OperationTool::DeletionCommand::InitiateDatabase()
 {
-  if(!ValidParameters(false))
-    return false;
-
-  leading_words.append(table);
-  leading_words.append(" where ");
-  return true;
+  return ValidParameters(false);
 }
 
 // Use source, a record, and leading_words, etc., to generate a MySQL query command
-string OperationTool::DeletionCommand::GetCommand(const vector<string>& source) throw(BadCommand)
+const string& OperationTool::DeletionCommand::GetCommand(const vector<string>& source) throw(BadCommand)
 {
-  string one_command(leading_words);
-  if(!BasicCommand(source, one_command))
-    throw BadCommand();
+  builder.Clear().Append(leading_words).Append(TableOfCommand(source)).Append(" where ");
 
+  bool first = true;
   for(int i=0;i<number_of_columns_for_query;++i)
   {
     if(columns_for_query[i].empty())
       continue;
-
-    int index_of_this_column = PropertyParser::GetInstance().GetIndex(columns_for_query[i]);
-    if(-1 == index_of_this_column)
-      continue;
-    one_command.append(columns_for_query[i]);
-    if(source[index_of_this_column].empty())
-      one_command.append(" is NULL and ");
+    if(!first)
+      builder.Append(" and ");
+    builder.Append(columns_for_query[i]);
+    const string& value = source[indexes_for_query[i]];
+    if(value.empty())
+      builder.Append(" is NULL");
     else
-    {
-      one_command.append(" = '");
-      one_command.append(source[index_of_this_column]);
-      one_command.append("' and ");
-    }
+      builder.Append(" = ").Value(value);
+    first = false;
   }
-  boost::erase_last(one_command, " and ");
-
-  ModifyCommand(one_command);
 
-//cout << "Deleting command: |" << one_command << "|." << endl;
-  return one_command;
+//cout << "Deleting command: |" << builder.Command() << "|." << endl;
+  return builder.Command();
 }
 
-void OperationTool::DeletionCommand::SpecificModify(string& command) const
-{ }
-
 
 // ===> TrivialErrorNullification <===
-// A tool class for effacing trivial errors from MySQLInterface
-#include <boost/io/ios_state.hpp>
+// A tool class for effacing trivial errors of a connection while it lives.
+// Only that connection is quiet: errors of others (in other threads) are
+// still printed.
 namespace {
   class TrivialErrorNullification {
-    ofstream outflow;
-    boost::io::ios_all_saver saver;
+    bool& quiet;
+    const bool before;
+  public:
+    TrivialErrorNullification(bool& q): quiet(q), before(q)
+    { quiet = true; }
+    ~TrivialErrorNullification()
+    { quiet = before; }
+  };
+}
+
+
+// ===> TSVStream <===
+// Records read by "load data local infile" as if from a TSV file: converted
+// line by line as the MySQL library asks for more, so no file nor copy of all
+// records is needed.
+namespace {
+  class TSVStream {
+    const vector<vector<string> >& data;
+    const vector<size_t>& records;
+    const vector<int>& indexes;
+    // Next record to convert
+    size_t next;
+    // Converted record not yet (entirely) read
+    string line;
+    // Bytes of <line> already read
+    size_t offset;
   public:
-    TrivialErrorNullification():
-      outflow("/dev/null"),
-      saver(cerr)
+    TSVStream(const vector<vector<string> >& d, const vector<size_t>& r, const vector<int>& i):
+      data(d), records(r), indexes(i), next(0), offset(0)
+    {}
+
+    // Copy at most <size> bytes into <buffer>. Returns number of bytes
+    // copied, 0 at the end of records.
+    int Read(char* buffer, unsigned int size)
+    {
+      unsigned int copied = 0;
+      while(copied < size)
+      {
+        if(offset == line.size())
+        {
+          if(next == records.size())
+            break;
+          Convert(data[records[next++]]);
+        }
+        size_t length = line.size() - offset;
+        if(length > size - copied)
+          length = size - copied;
+        memcpy(buffer + copied, line.data() + offset, length);
+        offset += length;
+        copied += length;
+      }
+      return copied;
+    }
+  private:
+    // A record to a line: columns separated by tabs, empty ones as NULL (\N)
+    // and special characters escaped by '\'
+    void Convert(const vector<string>& record)
     {
-      if(outflow.is_open())
-        cerr.rdbuf(outflow.rdbuf());
+      line.clear();
+      offset = 0;
+      for(size_t i=0;i<indexes.size();++i)
+      {
+        if(i)
+          line.push_back('\t');
+        const string& value = record[indexes[i]];
+        if(value.empty())
+          line.append("\\N");
+        else if("true" == value)
+          line.push_back('1');
+        else if("false" == value)
+          line.push_back('0');
+        else
+        {
+          for(size_t j=0;j<value.size();++j)
+          {
+            switch(value[j])
+            {
+              case '\\': line.append("\\\\"); break;
+              case '\t': line.append("\\t"); break;
+              case '\n': line.append("\\n"); break;
+              case '\r': line.append("\\r"); break;
+              case '\0': line.append("\\0"); break;
+              default: line.push_back(value[j]);
+            }
+          }
+        }
+      }
+      line.push_back('\n');
     }
   };
+
+  // Handlers for mysql_set_local_infile_handler. <userdata> is a TSVStream.
+  int InfileInit(void** ptr, const char*, void* userdata)
+  {
+    *ptr = userdata;
+    return 0;
+  }
+  int InfileRead(void* ptr, char* buffer, unsigned int size)
+  { return static_cast<TSVStream*>(ptr)->Read(buffer, size); }
+  void InfileEnd(void*)
+  {}
+  int InfileError(void*, char* message, unsigned int size)
+  {
+    strncpy(message, "Error converting records", size);
+    message[size - 1] = '\0';
+    return 2000;	// CR_UNKNOWN_ERROR
+  }
 }
 
 
+// ===> InLists <===
+namespace {
+  // Commands of "<head>(<value>, <value>, ...)", values being quoted, each
+  // no larger than <limit>
+  void InLists(const string& head, const vector<string>& quoted, size_t limit, vector<string>& commands)
+  {
+    string command;
+    for(size_t i=0;i<quoted.size();++i)
+    {
+      if(!command.empty() && command.size() + quoted[i].size() + 3 > limit)
+      {
+        command.append(")");
+        commands.push_back(command);
+        command.clear();
+      }
+      command.append(command.empty() ? head + "(" : ", ");
+      command.append(quoted[i]);
+    }
+    if(!command.empty())
+    {
+      command.append(")");
+      commands.push_back(command);
+    }
+  }
+
+  // Whether a value from the database equals a value from records. Numbers
+  // are compared by value (the server may print "1.50" for "1.5").
+  bool SameValue(const string& from_database, const string& from_record)
+  {
+    string expected("true" == from_record ? "1" : "false" == from_record ? "0" : from_record);
+    if(from_database == expected)
+      return true;
+    char* end1 = 0;
+    char* end2 = 0;
+    double v1 = strtod(from_database.c_str(), &end1);
+    double v2 = strtod(expected.c_str(), &end2);
+    return !from_database.empty() && !expected.empty() && !*end1 && !*end2 && v1 == v2;
+  }
+
+  // Whether two times are the same, by their digits only (the server prints
+  // "2017-06-26 00:00:00" for "2017-06-26_00:00:00")
+  bool SameTime(const string& from_database, const string& from_record)
+  {
+    string::const_iterator a = from_database.begin();
+    string::const_iterator b = from_record.begin();
+    while(true)
+    {
+      while(from_database.end() != a && !isdigit(*a))
+        ++a;
+      while(from_record.end() != b && !isdigit(*b))
+        ++b;
+      if(from_database.end() == a || from_record.end() == b)
+        return from_database.end() == a && from_record.end() == b;
+      if(*a++ != *b++)
+        return false;
+    }
+  }
+
+  // Text matched literally by "like" (wildcards escaped)
+  string Literally(const string& text)
+  {
+    string escaped;
+    escaped.reserve(text.size());
+    for(size_t i=0;i<text.size();++i)
+    {
+      if('\\' == text[i] || '%' == text[i] || '_' == text[i])
+        escaped.push_back('\\');
+      escaped.push_back(text[i]);
+    }
+    return escaped;
+  }
+
+  // Order of records by LFN
+  class ByLFN {
+    const vector<vector<string> >& data;
+    int index_of_lfn;
+  public:
+    ByLFN(const vector<vector<string> >& d, int i): data(d), index_of_lfn(i) {}
+    bool operator()(size_t a, size_t b) const
+    { return data[a][index_of_lfn] < data[b][index_of_lfn]; }
+  };
+
+  // Merge records listed from the table (lfn and the columns compared, in
+  // the order of LFN) with records scanned (also in the order of LFN), as
+  // they arrive
+  class CatalogMerger: public MySQLInterface::RowReceiver {
+    const vector<vector<string> >& data;
+    // Indexes (of <data>) of records scanned, in the order of LFN
+    const vector<size_t>& sorted;
+    int index_of_lfn;
+    // Indexes (of a record) of the columns listed after lfn, of which the
+    // one at <timed> (if any) is a time
+    const vector<int>& compared;
+    size_t timed;
+    // LFNs of the directories scanned: nothing else is ever deleted
+    const vector<string>& roots;
+    size_t next;
+  public:
+    // Indexes (of <data>) of records not in the table, and of those changed
+    vector<size_t> inserted;
+    vector<size_t> updated;
+    // LFNs of records in the table only
+    vector<string> deleted;
+    size_t unchanged;
+    // Records listed outside the directories scanned (left as they are)
+    size_t outside;
+
+    CatalogMerger(const vector<vector<string> >& d, const vector<size_t>& s, int i, const vector<int>& c, size_t t, const vector<string>& r):
+      data(d), sorted(s), index_of_lfn(i), compared(c), timed(t), roots(r), next(0), unchanged(0), outside(0) {}
+
+    void operator()(vector<string>& one_set)
+    {
+      const string& lfn = one_set.front();
+      while(next < sorted.size() && data[sorted[next]][index_of_lfn] < lfn)
+        inserted.push_back(sorted[next++]);
+      if(next == sorted.size() || data[sorted[next]][index_of_lfn] != lfn)
+      {
+        size_t i = 0;
+        while(i < roots.size() && !boost::starts_with(lfn, roots[i]))
+          ++i;
+        if(i < roots.size())
+          deleted.push_back(lfn);
+        else
+          ++outside;
+        return;
+      }
+
+      const vector<string>& record = data[sorted[next]];
+      size_t k = 0;
+      while(k < compared.size() && (timed == k ? SameTime(one_set[k+1], record[compared[k]])
+                                               : SameValue(one_set[k+1], record[compared[k]])))
+        ++k;
+      if(k == compared.size())
+        ++unchanged;
+      else
+        updated.push_back(sorted[next]);
+      ++next;
+    }
+
+    // Records scanned after the last one listed
+    void Finish()
+    {
+      while(next < sorted.size())
+        inserted.push_back(sorted[next++]);
+    }
+  };
+}
+
+
+// ===> OperationTool::MySQLOperator::PreparedInsertion <===
+// Array binding (records sent by one execution) is provided by MariaDB
+// Connector/C since 3.0
+#if defined(MARIADB_PACKAGE_VERSION_ID) && MARIADB_PACKAGE_VERSION_ID >= 30000
+#define ARRAY_BINDING
+#endif
+class OperationTool::MySQLOperator::PreparedInsertion {
+  MYSQL_STMT* statement;
+  // Indexes of columns (in a record) bound to the parameters
+  const vector<int> columns;
+  // Parameters
+  vector<MYSQL_BIND> binds;
+  vector<unsigned long> lengths;
+#ifdef ARRAY_BINDING
+  // Values of each column of all records kept, column by column
+  vector<vector<const char*> > array_values;
+  vector<vector<unsigned long> > array_lengths;
+#endif
+public:
+  // Records kept for one execution (array binding only)
+  vector<const vector<string>*> waiting;
+
+  // Prepare "insert into <table> (<names of columns>) values (?, ...)"
+  PreparedInsertion(MYSQL* mysql, const string& table, const vector<string>& names, const vector<int>& c):
+    columns(c),
+    binds(c.size()),
+    lengths(c.size())
+  {
+    string command("insert into ");
+    command.append(table);
+    command.append(" (");
+    for(size_t i=0;i<columns.size();++i)
+    {
+      if(i)
+        command.append(", ");
+      command.append(names[columns[i]]);
+    }
+    command.append(") values (?");
+    for(size_t i=1;i<columns.size();++i)
+      command.append(", ?");
+    command.append(")");
+
+    statement = ::mysql_stmt_init(mysql);
+    if(statement && ::mysql_stmt_prepare(statement, command.c_str(), command.size()))
+    {
+      cerr << "Can't prepare |" << command << "|: " << ::mysql_stmt_error(statement) << endl;
+      ::mysql_stmt_close(statement);
+      statement = 0;
+    }
+    memset(&binds[0], 0, sizeof(MYSQL_BIND) * binds.size());
+    for(size_t i=0;i<binds.size();++i)
+      binds[i].buffer_type = MYSQL_TYPE_STRING;
+  }
+  ~PreparedInsertion()
+  {
+    if(statement)
+      ::mysql_stmt_close(statement);
+  }
+
+  bool Ready() const { return statement; }
+  const char* Error() const { return statement ? ::mysql_stmt_error(statement) : "Not prepared"; }
+
+  // Insert <record>. Returns true if inserted
+  bool Execute(const vector<string>& record)
+  {
+    if(!statement)
+      return false;
+#ifdef ARRAY_BINDING
+    // Back to one record after an execution of arrays
+    unsigned int single = 0;
+    ::mysql_stmt_attr_set(statement, STMT_ATTR_ARRAY_SIZE, &single);
+#endif
+    for(size_t i=0;i<columns.size();++i)
+    {
+      const string& value = Value(record[columns[i]]);
+      binds[i].buffer = const_cast<char*>(value.data());
+      binds[i].buffer_length = lengths[i] = value.size();
+      binds[i].length = &lengths[i];
+    }
+    return !::mysql_stmt_bind_param(statement, &binds[0]) &&
+           !::mysql_stmt_execute(statement);
+  }
+
+#ifdef ARRAY_BINDING
+  // Insert all records in <waiting> by one execution. Returns true if all
+  // inserted
+  bool ExecuteWaiting()
+  {
+    if(!statement)
+      return false;
+    unsigned int N_records = waiting.size();
+    array_values.resize(columns.size());
+    array_lengths.resize(columns.size());
+    for(size_t i=0;i<columns.size();++i)
+    {
+      array_values[i].resize(N_records);
+      array_lengths[i].resize(N_records);
+      for(unsigned int j=0;j<N_records;++j)
+      {
+        const string& value = Value((*waiting[j])[columns[i]]);
+        array_values[i][j] = value.data();
+        array_lengths[i][j] = value.size();
+      }
+      // Column-wise binding: array of pointers to the values
+      binds[i].buffer = &array_values[i][0];
+      binds[i].length = &array_lengths[i][0];
+    }
+    return !::mysql_stmt_attr_set(statement, STMT_ATTR_ARRAY_SIZE, &N_records) &&
+           !::mysql_stmt_bind_param(statement, &binds[0]) &&
+           !::mysql_stmt_execute(statement);
+  }
+#endif
+
+private:
+  // Booleans are saved as numbers
+  static const string& Value(const string& value)
+  {
+    static const string one("1"), zero("0");
+    if("true" == value)
+      return one;
+    else if("false" == value)
+      return zero;
+    return value;
+  }
+};
+
+
 // ===> OperationTool::MySQLOperator <===
 // MySQL modulus used by OperationTool
 // Constructor
 OperationTool::MySQLOperator::MySQLOperator(const ArgumentParser& p):
   MySQLInterface(),
   parser(p),
-  accepted(false)
+  accepted(false),
+  finished(false),
+  uncommitted(0),
+  reached(0),
+  emitted(0)
 { the_mode = success = failure = 0; }
 
 // Destructor
 // All operations accepted, or rejected.
 OperationTool::MySQLOperator::~MySQLOperator()
 {
+  for(map<string, PreparedInsertion*>::iterator it = prepared.begin(); it != prepared.end(); ++it)
+    delete it->second;
+
   if(failure)
   {
     cerr << failure << " operation" << (failure>1?"s ":" ") << "failed." << endl;
     if(!accepted) accepted = false;
   }
 
-  if(accepted && 0 != success)
+  if(finished)
+    ;	// By Commit
+  else if(accepted && 0 != success)
   {
     cout << "Committing all operations..." << endl;
-    TrivialErrorNullification t;
-    DirectQuery("commit");
+    if(!Commit())
+      cerr << "\033[31mCommit failed, all operations undone...\033[0m" << endl;
   }
   else if(0 == success)
     cout << "Nothing done..." << endl;
   else
   {
-    cerr << "Undo all operations..." << endl;
-    TrivialErrorNullification t;
-    DirectQuery("rollback");
+    if(parser.CommitEvery())
+      cerr << "Undo operations since the last commit (see the journal)..." << endl;
+    else
+      cerr << "Undo all operations..." << endl;
+    Transaction("rollback");
+  }
+
+  if(emitted)
+  {
+    emitted->flush();
+    if(!*emitted)
+      cerr << "\033[31mError writing commands into |" << parser.EmitSQL() << "|...\033[0m" << endl;
+    delete emitted;
   }
 }
 
+// Commit all operations
+bool OperationTool::MySQLOperator::Commit()
+{
+  finished = true;
+  if(Transaction("commit"))
+  {
+    if(parser.CommitEvery() && !emitted)
+      parser.WriteJournal(reached);
+    return true;
+  }
+  errorIntoMySQL();
+  Transaction("rollback");
+  return false;
+}
+
+// Control the transaction
+bool OperationTool::MySQLOperator::Transaction(const string& command)
+{
+  if(emitted)
+    return Emit(command);
+  TrivialErrorNullification t(quiet);
+  return DirectQuery(command);
+}
+
+// Write a command, as a line
+bool OperationTool::MySQLOperator::Emit(const string& the_command)
+{
+  emitted->write(the_command.data(), the_command.size());
+  emitted->write(";\n", 2);
+  rows = 1;
+  return !emitted->fail();
+}
+
+// Leave out records already recorded
+void OperationTool::MySQLOperator::SkipExisting(const BaseCommand& generator, const vector<vector<string> >& data, const vector<size_t>& records, vector<size_t>& kept)
+{
+  kept.clear();
+  if(column_names.empty())
+    parser.Columns(column_names);
+  vector<string>::const_iterator lfn = find(column_names.begin(), column_names.end(), "lfn");
+  if(column_names.end() == lfn)
+  {
+    kept = records;
+    return;
+  }
+  int index_of_lfn = lfn - column_names.begin();
+
+  // LFNs of each table
+  map<string, set<string> > wanted;
+  vector<string> tables(records.size());
+  for(size_t i=0;i<records.size();++i)
+  {
+    tables[i] = generator.TableOf(data[records[i]]);
+    if(!tables[i].empty())
+      wanted[tables[i]].insert(data[records[i]][index_of_lfn]);
+  }
+
+  // "select lfn from <table> where lfn in (...)"
+  map<string, set<string> > existing;
+  for(map<string, set<string> >::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+  {
+    vector<string> quoted;
+    quoted.reserve(it->second.size());
+    for(set<string>::const_iterator lfn = it->second.begin(); lfn != it->second.end(); ++lfn)
+      quoted.push_back("'" + Escape(*lfn) + "'");
+    vector<string> selections;
+    InLists("select lfn from " + it->first + " where lfn in ", quoted, MaxAllowedPacket(), selections);
+    for(size_t i=0;i<selections.size();++i)
+    {
+      vector<vector<string> > found;
+      if(!GetDataFromDB(selections[i], found))
+      {
+        cerr << "Warning... Can't check recorded LFNs in " << it->first << ", inserting all..." << endl;
+        existing.erase(it->first);
+        break;
+      }
+      ClearData();
+      set<string>& recorded = existing[it->first];
+      for(size_t j=0;j<found.size();++j)
+        recorded.insert(found[j][0]);
+    }
+  }
+
+  // Records rejected by their tables are kept, to be counted as failures
+  vector<string> skipped;
+  kept.reserve(records.size());
+  for(size_t i=0;i<records.size();++i)
+  {
+    map<string, set<string> >::const_iterator recorded = existing.find(tables[i]);
+    if(existing.end() != recorded && recorded->second.count(data[records[i]][index_of_lfn]))
+      skipped.push_back(data[records[i]][index_of_lfn]);
+    else
+      kept.push_back(records[i]);
+  }
+  if(skipped.empty())
+    return;
+
+  const size_t N_shown = 5;
+  cout << skipped.size() << (skipped.size()>1?" records":" record") << " already recorded, skipped";
+  for(size_t i=0;i<skipped.size() && i<N_shown;++i)
+    cout << (i ? ", " : ": ") << skipped[i];
+  if(skipped.size() > N_shown)
+    cout << ", ...";
+  cout << endl;
+}
+
+// Compare records scanned with those of the table under the directories
+// scanned, listed in the order of LFN (by bytes, as std::string compares)
+bool OperationTool::MySQLOperator::Compare(const vector<vector<string> >& data, vector<size_t>& inserted, vector<size_t>& updated, vector<string>& deleted)
+{
+  if(column_names.empty())
+    parser.Columns(column_names);
+  vector<string>::const_iterator lfn = find(column_names.begin(), column_names.end(), "lfn");
+  if(column_names.end() == lfn)
+  {
+    cerr << "No LFN found from all columns..." << endl;
+    return false;
+  }
+  int index_of_lfn = lfn - column_names.begin();
+
+  vector<size_t> sorted(data.size());
+  for(size_t i=0;i<sorted.size();++i)
+    sorted[i] = i;
+  sort(sorted.begin(), sorted.end(), ByLFN(data, index_of_lfn));
+
+  // "select lfn, size, last_modified from <table> where (lfn like '<root>%'
+  // and binary lfn like '<root>%') or ... order by binary lfn": "like"
+  // follows the collation of the column (often case-insensitive), the
+  // binary one keeps other directories out, and the first keeps the range
+  // on the index
+  vector<string> names(1, "lfn");
+  vector<int> compared;
+  size_t timed = string::npos;
+  string listed[] = { "size", "last_modified" };
+  for(size_t i=0;i<sizeof(listed)/sizeof(listed[0]);++i)
+  {
+    vector<string>::const_iterator column = find(column_names.begin(), column_names.end(), listed[i]);
+    if(column_names.end() == column)
+      continue;
+    if("last_modified" == listed[i])
+      timed = compared.size();
+    compared.push_back(column - column_names.begin());
+    names.push_back(listed[i]);
+  }
+  string table(parser.Table());
+  string command("select " + boost::join(names, ", ") + " from " + table + " where ");
+  const vector<string>& roots = parser.ScannedRoots();
+  for(size_t i=0;i<roots.size();++i)
+  {
+    if(i)
+      command.append(" or ");
+    string pattern("'" + Escape(Literally(roots[i])) + "%'");
+    command.append("(lfn like " + pattern + " and binary lfn like " + pattern + ")");
+  }
+  command.append(" order by binary lfn");
+
+  CatalogMerger merger(data, sorted, index_of_lfn, compared, timed, roots);
+  if(!StreamDataFromDB(command, merger))
+  {
+    cerr << "Can't list records of " << table << "..." << endl;
+    return false;
+  }
+  ClearData();
+  merger.Finish();
+
+  cout << merger.inserted.size() << " to insert, " << merger.updated.size() << " to update, "
+       << merger.deleted.size() << " to delete, " << merger.unchanged << " unchanged..." << endl;
+  if(merger.outside)
+    cerr << "Warning... " << merger.outside << " record(s) listed outside the directories scanned, left as they are..." << endl;
+  inserted.swap(merger.inserted);
+  updated.swap(merger.updated);
+  deleted.swap(merger.deleted);
+  return true;
+}
+
+// Commit every "commit-every" records
+// A failed commit stops the work: records since the last commit are failed,
+// and the journal stays where it was.
+bool OperationTool::MySQLOperator::Checkpoint(size_t position, size_t N_records)
+{
+  uncommitted += N_records;
+  if(0 == parser.CommitEvery() || uncommitted < size_t(parser.CommitEvery()))
+  {
+    reached = position;
+    return true;
+  }
+
+  Flush();
+  if(!Transaction("commit"))
+  {
+    cerr << "\033[31mCommit failed at record " << position << ", stop here...\033[0m" << endl;
+    failure += uncommitted;
+    uncommitted = 0;
+    accepted = false;
+    return false;
+  }
+  Transaction("start transaction");
+  reached = position;
+  if(!emitted)
+    parser.WriteJournal(position);
+  uncommitted = 0;
+  return true;
+}
+
 // Initiate the database connection, find the mode, and start a transaction
 bool OperationTool::MySQLOperator::InitiateDatabase()
 {
-  if(!connectMySQL(parser.Server().c_str(), parser.User().c_str(), parser.Passwd().c_str(), parser.Database().c_str(), parser.Port()))
+  // Commands written rather than sent: no connection
+  if(!parser.EmitSQL().empty())
   {
-    cerr << "Connection failed!" << endl;
-    return false;
+    if(parser.StandardOutput())
+      emitted = new ostream(parser.StandardOutput());
+    else
+      emitted = new ofstream(parser.EmitSQL().c_str());
+    if(!*emitted)
+    {
+      cerr << "Can't write commands into |" << parser.EmitSQL() << "|..." << endl;
+      delete emitted;
+      emitted = 0;
+      return false;
+    }
+    // As much as a command holds by default (MySQL 5.7)
+    max_packet = (4ul << 20) - 1024;
+  }
+  else
+  {
+    // "load data local" is refused by the client library by default
+    if(parser.BulkLoading())
+    {
+      unsigned int enabled = 1;
+      ::mysql_options(&mysqlInstance, MYSQL_OPT_LOCAL_INFILE, &enabled);
+    }
+    if(!connectMySQL(parser.Address().c_str(), parser.User().c_str(), parser.Passwd().c_str(), parser.Database().c_str(), parser.Port()))
+    {
+      cerr << "Connection failed!" << endl;
+      return false;
+    }
+    // Records were parsed with the cached structure of table, if any
+    if(!parser.SchemaConfirmed())
+      return false;
   }
 
   the_mode = parser.OperationMode();
   if(ArgumentParser::insertion_mode > the_mode ||
-     ArgumentParser::deletion_mode < the_mode)
+     ArgumentParser::upsert_mode < the_mode)
   {
     cerr << "Invalid operation mode: " << the_mode << endl;
     return false;
   }
+  else if(ArgumentParser::upsert_mode == the_mode)
+    real_method = parser.Replacing() ? &MySQLOperator::Replace : &MySQLOperator::Insert;
   else if(ArgumentParser::deletion_mode == the_mode)
     real_method = &MySQLOperator::Delete;
   else if(ArgumentParser::updating_mode == the_mode)
@@ -903,27 +2632,36 @@ bool OperationTool::MySQLOperator::InitiateDatabase()
   else 	// ArgumentParser::insertion_mode == the_mode
     real_method = &MySQLOperator::Insert;
 
-  TrivialErrorNullification t;
+  if(emitted)
+  {
+    real_method = &MySQLOperator::Emit;
+    Transaction("start transaction");
+    return true;
+  }
+
+  TrivialErrorNullification t(quiet);
   DirectQuery("set autocommit = 0");
   DirectQuery("start transaction");
   return true;
 }
 
 // Create the instance of insert/update/delete
-OperationTool::BaseCommand* OperationTool::MySQLOperator::Generate(const vector<int>& indexes) const
+OperationTool::BaseCommand* OperationTool::MySQLOperator::Generate(const vector<int>& indexes)
 {
+  // Escaped by hand without a connection
+  MySQLInterface* connection = emitted ? 0 : this;
   if(indexes.empty())
   {
     cerr << "No columns selected..." << endl;
     return NULL;
   }
 
-  if(ArgumentParser::insertion_mode == the_mode)
-    return new OperationTool::InsertionCommand(parser, indexes);
+  if(ArgumentParser::insertion_mode == the_mode || ArgumentParser::upsert_mode == the_mode)
+    return new OperationTool::InsertionCommand(parser, indexes, connection);
   else if(ArgumentParser::updating_mode == the_mode)
-    return new OperationTool::UpdatingCommand(parser, indexes);
+    return new OperationTool::UpdatingCommand(parser, indexes, connection);
   else if(ArgumentParser::deletion_mode == the_mode)
-    return new OperationTool::DeletionCommand(parser, indexes);
+    return new OperationTool::DeletionCommand(parser, indexes, connection);
   else
   {
     cerr << "Unrecognized mode |" << the_mode << "|..." << endl;
@@ -947,6 +2685,501 @@ void OperationTool::MySQLOperator::OneRecord(const std::string& the_command)
   }
 }
 
+// Keep insertions of a table for the batch
+void OperationTool::MySQLOperator::Enqueue(InsertionCommand& generator, const vector<vector<string> >& data, const vector<size_t>& records, const string& table)
+{
+  // The columns may differ from those waiting (e.g. another window)
+  string head, tail;
+  generator.Head(table, head, tail);
+  Batch& batch = batches[table];
+  if(batch.head != head || batch.tail != tail)
+  {
+    Flush(batch);
+    batch.head.swap(head);
+    batch.tail.swap(tail);
+  }
+
+  for(size_t i=0;i<records.size();++i)
+  {
+    const string& tuple = generator.Tuple(data[records[i]]);
+    if(!batch.tuples.empty() && batch.bytes + tuple.size() + 1 > MaxAllowedPacket())
+      Flush(batch);
+    if(batch.tuples.empty())
+      batch.bytes = batch.head.size() + batch.tail.size();
+
+    batch.tuples.push_back(tuple);
+    batch.bytes += tuple.size() + 1;
+    if(batch.tuples.size() == size_t(parser.BatchSize()))
+      Flush(batch);
+  }
+}
+
+// Load records by "load data local infile"
+void OperationTool::MySQLOperator::BulkLoad(const vector<vector<string> >& data, const vector<size_t>& records, const vector<int>& indexes, const string& table)
+{
+  if(records.empty())
+    return;
+
+  vector<string> names;
+  parser.Columns(names);
+  vector<string> columns;
+  for(size_t i=0;i<indexes.size();++i)
+    columns.push_back(names[indexes[i]]);
+
+  // The name of file is never opened: the handlers read from <stream>
+  string command("load data local infile 'records.tsv' into table ");
+  command.append(table);
+  command.append(" (");
+  command.append(boost::join(columns, ", "));
+  command.append(")");
+
+  TSVStream stream(data, records, indexes);
+  ::mysql_set_local_infile_handler(&mysqlInstance, InfileInit, InfileRead, InfileEnd, InfileError, &stream);
+  int res = ::mysql_real_query(&mysqlInstance, command.c_str(), command.size());
+  ::mysql_set_local_infile_default(&mysqlInstance);
+  if(res)
+  {
+    cerr << "Loading records into " << table << " failed..." << endl;
+    errorIntoMySQL();
+    failure += records.size();
+    return;
+  }
+
+  // With "local", records rejected (e.g. duplicated keys) are skipped with a
+  // warning rather than failing all
+  size_t loaded = ::mysql_affected_rows(&mysqlInstance);
+  success += loaded;
+  if(loaded < records.size())
+  {
+    failure += records.size() - loaded;
+    cerr << records.size() - loaded << " of " << records.size() << " records skipped by " << table
+         << " (" << ::mysql_warning_count(&mysqlInstance) << " warnings)..." << endl;
+  }
+}
+
+// Update records through a staging table
+bool OperationTool::MySQLOperator::BulkUpdate(const vector<vector<string> >& data, const vector<size_t>& records, const vector<int>& indexes, const string& table, bool committing)
+{
+  if(records.empty())
+    return true;
+  if(column_names.empty())
+    parser.Columns(column_names);
+  int failed = failure;
+
+  // LFN first, then the columns to set
+  vector<string>::const_iterator lfn = find(column_names.begin(), column_names.end(), "lfn");
+  int index_of_lfn = lfn - column_names.begin();
+  vector<int> columns(1, index_of_lfn);
+  for(size_t i=0;i<indexes.size();++i)
+  {
+    if(index_of_lfn != indexes[i])
+      columns.push_back(indexes[i]);
+  }
+  if(column_names.end() == lfn || 1 == columns.size())
+  {
+    cerr << "Nothing to update in " << table << "..." << endl;
+    failure += records.size();
+    return false;
+  }
+  vector<string> names;
+  for(size_t i=0;i<columns.size();++i)
+    names.push_back(column_names[columns[i]]);
+  string joined_names(boost::join(names, ", "));
+
+  // The last record of an LFN wins, as if updated one by one. LFNs are
+  // sorted as well, to cut them into ranges.
+  map<string, size_t> latest;
+  for(size_t i=0;i<records.size();++i)
+    latest[data[records[i]][index_of_lfn]] = records[i];
+  failure += records.size() - latest.size();
+
+  // Staging table: same columns (and types) as the target, and the number
+  // of the chunk of each LFN
+  string staging("tmp_update_" + table);
+  {
+    TrivialErrorNullification t(quiet);
+    DirectQuery("drop temporary table if exists " + staging);
+  }
+  if(!CreateTemporaryTable(staging, "(chunk int unsigned not null, primary key (lfn), key (chunk)) select " + joined_names + " from " + table + " limit 0"))
+  {
+    cerr << "Can't create the staging table for " << table << "..." << endl;
+    failure += latest.size();
+    return false;
+  }
+
+  // New values into the staging table, in batches. Consecutive LFNs are
+  // numbered into chunks, each updated by a command of its own (by number,
+  // not by a range of LFN, whose order follows the collation of the table)
+  size_t chunk = parser.BatchSize() ? parser.BatchSize() : 1000;
+  vector<string> tuples;
+  tuples.reserve(latest.size());
+  size_t position = 0;
+  for(map<string, size_t>::const_iterator it = latest.begin(); it != latest.end(); ++it, ++position)
+  {
+    const vector<string>& record = data[it->second];
+    ostringstream tuple;
+    tuple << "(" << position / chunk;
+    for(size_t i=0;i<columns.size();++i)
+    {
+      const string& value = record[columns[i]];
+      tuple << ", '" << ("true" == value ? "1" : "false" == value ? "0" : Escape(value)) << "'";
+    }
+    tuple << ")";
+    tuples.push_back(tuple.str());
+  }
+  if(!BatchInsert("insert into " + staging + " (chunk, " + joined_names + ") values ", tuples))
+  {
+    cerr << "Can't load new values into the staging table for " << table << "..." << endl;
+    failure += latest.size();
+    return false;
+  }
+  tuples.clear();
+
+  // "update <table> join <staging> using (lfn) set <table>.<c> = <staging>.<c>, ..."
+  string head("update ");
+  head.append(table);
+  head.append(" join ");
+  head.append(staging);
+  head.append(" using (lfn) set ");
+  for(size_t i=1;i<names.size();++i)
+  {
+    if(1 < i)
+      head.append(", ");
+    head.append(table + "." + names[i] + " = " + staging + "." + names[i]);
+  }
+  head.append(" where ");
+  head.append(staging);
+  head.append(".chunk = ");
+
+  // Chunk by chunk. With <committing>, each is committed at once, so locks
+  // are held shortly.
+  size_t N_chunks = (latest.size() + chunk - 1) / chunk;
+  for(size_t i=0;i<N_chunks;++i)
+  {
+    size_t N_chunk = (i + 1 < N_chunks) ? chunk : latest.size() - i * chunk;
+    ostringstream command;
+    command << head << i;
+    if(!Update(command.str()))
+    {
+      cerr << "MySQL query failed on |" << command.str() << "|..." << endl;
+      errorIntoMySQL();
+      failure += N_chunk;
+      continue;
+    }
+
+    // "Rows matched: M  Changed: C  Warnings: W"
+    const char* info = ::mysql_info(&mysqlInstance);
+    const char* matched_text = info ? strstr(info, "matched:") : 0;
+    size_t matched = matched_text ? strtoul(matched_text + 8, 0, 10) : N_chunk;
+    success += matched;
+    if(matched < N_chunk)
+    {
+      failure += N_chunk - matched;
+      cerr << N_chunk - matched << " of " << N_chunk << " records not found in " << table << "..." << endl;
+    }
+    if(committing)
+    {
+      TrivialErrorNullification t(quiet);
+      DirectQuery("commit");
+    }
+  }
+
+  TrivialErrorNullification t(quiet);
+  DirectQuery("drop temporary table " + staging);
+  return failure == failed;
+}
+
+// Delete records by LFN
+bool OperationTool::MySQLOperator::KeyDelete(const vector<vector<string> >& data, const vector<size_t>& records, const vector<int>& indexes, const string& table, bool verifying)
+{
+  if(records.empty())
+    return true;
+  if(column_names.empty())
+    parser.Columns(column_names);
+  int failed = failure;
+
+  vector<string>::const_iterator lfn = find(column_names.begin(), column_names.end(), "lfn");
+  if(column_names.end() == lfn)
+  {
+    cerr << "No LFN found from all columns..." << endl;
+    failure += records.size();
+    return false;
+  }
+  int index_of_lfn = lfn - column_names.begin();
+
+  // Records by LFN (repeated ones are deleted once)
+  map<string, size_t> wanted;
+  for(size_t i=0;i<records.size();++i)
+    wanted[data[records[i]][index_of_lfn]] = records[i];
+  failure += records.size() - wanted.size();
+
+  // "delete from <table> where lfn in (...)". With <verifying>, the other
+  // columns are compared by the server, as the commands for each record do:
+  // "... where <c> is NULL and (lfn, <c1>, ...) in ((...), ...)", records
+  // grouped by their empty columns.
+  vector<int> compared;
+  if(verifying)
+  {
+    for(size_t i=0;i<indexes.size();++i)
+    {
+      if(index_of_lfn != indexes[i])
+        compared.push_back(indexes[i]);
+    }
+  }
+  map<string, vector<string> > groups;
+  for(map<string, size_t>::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+  {
+    const vector<string>& record = data[it->second];
+    string nulls;
+    vector<string> names(1, "lfn");
+    string quoted("'" + Escape(it->first) + "'");
+    for(size_t i=0;i<compared.size();++i)
+    {
+      const string& value = record[compared[i]];
+      if(value.empty())
+      {
+        nulls.append(column_names[compared[i]] + " is NULL and ");
+        continue;
+      }
+      names.push_back(column_names[compared[i]]);
+      quoted.append(", '");
+      quoted.append("true" == value ? "1" : "false" == value ? "0" : Escape(value));
+      quoted.append("'");
+    }
+    string head("delete from " + table + " where " + nulls);
+    if(1 == names.size())
+      head.append("lfn in ");
+    else
+    {
+      head.append("(" + boost::join(names, ", ") + ") in ");
+      quoted = "(" + quoted + ")";
+    }
+    groups[head].push_back(quoted);
+  }
+  vector<string> deletions;
+  for(map<string, vector<string> >::const_iterator it = groups.begin(); it != groups.end(); ++it)
+    InLists(it->first, it->second, MaxAllowedPacket(), deletions);
+
+  size_t N_deleted = 0;
+  for(size_t i=0;i<deletions.size();++i)
+  {
+    if(Delete(deletions[i]))
+      N_deleted += GetAffectRows();
+    else
+    {
+      cerr << "Deletion of a batch of LFNs from " << table << " failed..." << endl;
+      errorIntoMySQL();
+    }
+  }
+  success += N_deleted;
+  if(N_deleted < wanted.size())
+  {
+    failure += wanted.size() - N_deleted;
+    cerr << wanted.size() - N_deleted << " of " << wanted.size() << " records not "
+         << (verifying ? "found or not matching" : "deleted") << " in " << table << "..." << endl;
+  }
+  return failure == failed;
+}
+
+// Insert a record by a prepared statement
+void OperationTool::MySQLOperator::PreparedRecord(const vector<string>& record, const string& table)
+{
+  if(column_names.empty())
+    parser.Columns(column_names);
+
+  // Columns with contents, as the key of the statement
+  vector<int> columns;
+  ostringstream key;
+  key << table << ":";
+  for(size_t i=0;i<record.size() && i<column_names.size();++i)
+  {
+    if(record[i].empty())
+      continue;
+    columns.push_back(i);
+    key << i << ",";
+  }
+  if(columns.empty())
+  {
+    cerr << "Nothing to insert..." << endl;
+    ++failure;
+    return;
+  }
+
+  PreparedInsertion*& statement = prepared[key.str()];
+  if(!statement)
+    statement = new PreparedInsertion(&mysqlInstance, table, column_names, columns);
+  if(!statement->Ready())
+  {
+    ++failure;
+    return;
+  }
+
+#ifdef ARRAY_BINDING
+  statement->waiting.push_back(&record);
+  size_t chunk = parser.BatchSize() ? parser.BatchSize() : 1000;
+  if(statement->waiting.size() >= chunk)
+    Flush();
+#else
+  if(statement->Execute(record))
+    ++success;
+  else
+  {
+    cerr << "Prepared insertion failed on |" << boost::join(record, ", ") << "|: " << statement->Error() << endl;
+    ++failure;
+  }
+#endif
+}
+
+// Send the waiting insertions
+void OperationTool::MySQLOperator::Flush()
+{
+#ifdef ARRAY_BINDING
+  // Records kept for prepared statements: if an execution fails, nothing is
+  // inserted by it, and the records are retried one by one.
+  for(map<string, PreparedInsertion*>::iterator it = prepared.begin(); it != prepared.end(); ++it)
+  {
+    PreparedInsertion& statement = *it->second;
+    size_t N_waiting = statement.waiting.size();
+    if(0 == N_waiting)
+      continue;
+    if(statement.ExecuteWaiting())
+      success += N_waiting;
+    else
+    {
+      cerr << "Insertion of " << N_waiting << " records failed, retrying one by one..." << endl;
+      for(size_t i=0;i<N_waiting;++i)
+      {
+        if(statement.Execute(*statement.waiting[i]))
+          ++success;
+        else
+        {
+          cerr << "Prepared insertion failed on |" << boost::join(*statement.waiting[i], ", ") << "|: " << statement.Error() << endl;
+          ++failure;
+        }
+      }
+    }
+    statement.waiting.clear();
+  }
+#endif
+
+  for(map<string, Batch>::iterator it = batches.begin(); it != batches.end(); ++it)
+    Flush(it->second);
+}
+
+// Send the waiting insertions of a table
+void OperationTool::MySQLOperator::Flush(Batch& batch)
+{
+  size_t N_waiting = batch.tuples.size();
+  if(0 == N_waiting)
+    return;
+  else if(1 == N_waiting)
+    OneRecord(batch.head + batch.tuples.front() + batch.tail);
+  else
+  {
+    string command(batch.head);
+    command.reserve(batch.bytes);
+    command.append(boost::join(batch.tuples, ","));
+    command.append(batch.tail);
+    bool done = false;
+    {
+      TrivialErrorNullification t(quiet);
+      done = (this->*real_method)(command);
+    }
+    if(done)
+      success += N_waiting;
+    else
+    {
+      // A failed statement leaves nothing in the table (InnoDB), so the
+      // records are retried one by one to find the one(s) failed
+      cerr << "Insertion of " << N_waiting << " records failed, retrying one by one..." << endl;
+      for(size_t i=0;i<N_waiting;++i)
+        OneRecord(batch.head + batch.tuples[i] + batch.tail);
+    }
+  }
+
+  // The queue (and its memory) is kept for the table
+  batch.tuples.clear();
+  batch.bytes = 0;
+}
+
+
+// ===> OperationTool::Shard <===
+// Records handled by a connection of their own, in background
+class OperationTool::Shard: public BackgroundTask {
+  const OperationTool& tool;
+  const ArgumentParser& parser;
+  const vector<vector<string> >& all_data;
+  const vector<int>& indexes;
+  // Whether all records have been handled
+  bool done;
+public:
+  // Indexes of records of this shard
+  const vector<size_t>& records;
+  MySQLOperator manipulater;
+
+  Shard(const OperationTool& t, const ArgumentParser& p, const vector<vector<string> >& d, const vector<size_t>& r, const vector<int>& i):
+    tool(t), parser(p), all_data(d), indexes(i), done(false), records(r), manipulater(p)
+  {}
+  ~Shard() { Join(); }
+
+  bool Done() const { return done; }
+protected:
+  void Run() { done = tool.Process(parser, manipulater, all_data, records, indexes); }
+};
+
+namespace {
+  // Index of the shard of <record>, by a hash (FNV-1a) of its LFN. Records
+  // of the same LFN are always in the same shard.
+  size_t ShardOf(const vector<string>& record, int index_of_lfn, size_t N_shards)
+  {
+    if(0 > index_of_lfn || record.size() <= size_t(index_of_lfn))
+      return 0;
+    const string& lfn = record[index_of_lfn];
+    unsigned long hash = 2166136261UL;
+    for(size_t i=0;i<lfn.size();++i)
+    {
+      hash ^= static_cast<unsigned char>(lfn[i]);
+      hash = (hash * 16777619UL) & 0xffffffffUL;
+    }
+    return hash % N_shards;
+  }
+
+  // Indexes of columns with no empty (NULL) content in any record
+  void NonEmptyColumns(const vector<vector<string> >& all_data, size_t N_columns, vector<int>& indexes)
+  {
+    // In case that some columns are to be removed
+    vector<int> removing(N_columns);
+    for(size_t i=0;i<all_data.size();++i)
+    {
+      for(size_t j=0;j<N_columns;++j)
+      {
+        if(all_data[i][j].empty())
+          ++removing[j];		// NULL detected
+      }
+    }
+
+    indexes.clear();
+    indexes.reserve(N_columns);
+    for(size_t i=0;i<N_columns;++i)
+    {
+      if(0 == removing[i])	// No NULL contents
+        indexes.push_back(i);
+    }
+  }
+
+  // Rate of handling, to compare the ways of insertion
+  void ReportRate(size_t N_records, const timeval& start)
+  {
+    timeval stop;
+    gettimeofday(&stop, 0);
+    double elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+    cout << N_records << (N_records>1?" records":" record") << " handled in " << elapsed << " s";
+    if(0 < elapsed)
+      cout << " (" << N_records / elapsed << " records/s)";
+    cout << "." << endl;
+  }
+}
+
 
 // ===> OperationTool <===
 // Construction
@@ -969,7 +3202,7 @@ bool OperationTool::Authentication() const
 bool OperationTool::Run(const ArgumentParser& parser)
 {
   size_t N_records = holder.N_records();	// Number of records
-  if(0 == N_records)
+  if(0 == N_records && !parser.StreamWindow() && !parser.Reconciling())
   {
     cerr << "No records acquired..." << endl;
     return false;
@@ -982,47 +3215,242 @@ bool OperationTool::Run(const ArgumentParser& parser)
     return false;
   }
 
-  // In case that some columns are to be removed
-  vector<int> removing(N_columns);
+  // Records read and sent window by window
+  if(parser.StreamWindow())
+    return Stream(parser);
+
+  // Differences from the table only
+  if(parser.Reconciling())
+    return Reconcile(parser);
+
   // Container of all records. Each element as a record, each element of a
   // record as an aspect of it.
-  vector<vector<string> > all_data;
-  all_data.reserve(N_records);
+  vector<vector<string> > all_data(N_records);
   for(size_t i=0;i<N_records;++i)
+    holder.GetRecord(i, all_data[i]);
+
+  vector<int> indexes;	// Indexes of columns whose contents are not NULL
+  NonEmptyColumns(all_data, N_columns, indexes);
+  if(indexes.size() != N_columns)
+  {
+    if(ArgumentParser::json_file == parser.TerminalMode())
+      cout << "Trivial column detected..." << endl;
+    N_columns = indexes.size();
+  }
+  if(0 == N_columns)
+  {
+    cout << "All columns are trivial. Nothing to do." << endl;
+    return true;
+  }
+
+  // Records are handled by one connection, or shared by a hash of LFN among
+  // connections working at the same time
+  size_t N_connections = parser.Connections();
+  timeval start;
+  gettimeofday(&start, 0);
+  bool done = false;
+  if(1 == N_connections)
+  {
+    // Create MySQLOperator for OperationTool and initiate the database
+    MySQLOperator manipulater(parser);
+    if(!manipulater.InitiateDatabase())
+    {
+      cerr << "Can't initiate MySQL handler..." << endl;
+      return false;
+    }
+    // Records committed by an earlier run are skipped
+    size_t first = parser.ResumeFrom() < N_records ? parser.ResumeFrom() : N_records;
+    vector<size_t> records;
+    records.reserve(N_records - first);
+    for(size_t i=first;i<N_records;++i)
+      records.push_back(i);
+    done = Process(parser, manipulater, all_data, records, indexes);
+    ReportRate(records.size(), start);
+    // If it gets here, ready to commit the modification.
+    if(done)
+      manipulater.Accepted();
+  }
+  else
   {
-    vector<string> one_record;
-    holder.GetRecord(i, one_record);
-    for(size_t j=0;j<N_columns;++j)
+    int index_of_lfn = PropertyParser::GetInstance().GetIndex("lfn");
+    vector<vector<size_t> > sharded(N_connections);
+    for(size_t i=0;i<N_records;++i)
+      sharded[ShardOf(all_data[i], index_of_lfn, N_connections)].push_back(i);
+
+    // Connections are made one by one, and then work at the same time
+    vector<Shard*> shards;
+    done = true;
+    for(size_t i=0;i<N_connections && done;++i)
+    {
+      shards.push_back(new Shard(*this, parser, all_data, sharded[i], indexes));
+      done = shards.back()->manipulater.InitiateDatabase();
+      if(!done)
+        cerr << "Can't initiate MySQL handler for connection " << i+1 << "..." << endl;
+    }
+    if(done)
     {
-      if(one_record[j].empty())
+      for(size_t i=0;i<shards.size();++i)
+        shards[i]->Start();
+    }
+    for(size_t i=0;i<shards.size();++i)
+    {
+      shards[i]->Join();
+      done = done && shards[i]->Done();
+    }
+    ReportRate(N_records, start);
+
+    // Transactions are committed one after another once all connections
+    // finished, or all undone. After a failed commit, the connections left
+    // are undone, but those before it are committed already.
+    if(!done)
+      cerr << "\033[31mA connection didn't finish, undo all connections...\033[0m" << endl;
+    vector<string> states(shards.size(), "undone");
+    size_t N_committed = 0;
+    for(size_t i=0;i<shards.size() && done;++i)
+    {
+      done = shards[i]->manipulater.Commit();
+      if(done)
       {
-        ++removing[j];		// NULL detected
-//      one_record[j].assign("NULL");
+        states[i] = "committed";
+        ++N_committed;
       }
+      else
+        states[i] = "commit failed, undone";
     }
-    all_data.push_back(one_record);
+
+    // Report of each connection
+    for(size_t i=0;i<shards.size();++i)
+    {
+      cout << "Connection " << i+1 << ": " << shards[i]->records.size() << " record(s), "
+           << shards[i]->manipulater.Successes() << " done, "
+           << shards[i]->manipulater.Failures() << " failed"
+           << (shards[i]->Done() ? ", " : " (aborted), ") << states[i] << "." << endl;
+    }
+    if(0 != N_committed && N_committed < shards.size())
+      cerr << "\033[31mA commit failed after " << N_committed << " of " << shards.size()
+           << " connections committed: the table is changed partly (see above)...\033[0m" << endl;
+    for(size_t i=0;i<shards.size();++i)
+      delete shards[i];
   }
 
-  vector<int> indexes;	// Indexes of columns whose contents are not NULL
-  indexes.reserve(N_columns);
-  for(size_t i=0;i<N_columns;++i)
+  return done;
+}
+
+// Streaming: records are parsed, sent and released a window at a time, so
+// memory doesn't grow with the input. Repeated records are detected within
+// a window only.
+bool OperationTool::Stream(const ArgumentParser& parser) const
+{
+  MySQLOperator manipulater(parser);
+  if(!manipulater.InitiateDatabase())
   {
-    if(0 == removing[i])	// No NULL contents
-      indexes.push_back(i);
+    cerr << "Can't initiate MySQL handler..." << endl;
+    return false;
   }
-  if(indexes.size() != N_columns)
+
+  const PropertyParser& property = PropertyParser::GetInstance();
+  const size_t window_size = parser.StreamWindow();
+  const vector<string>& json_files = parser.JSONFiles();
+  RecordsHolder window;
+  size_t N_records = 0;
+  bool done = true;
+  timeval start;
+  gettimeofday(&start, 0);
+  for(size_t i=0;i<json_files.size() && done;++i)
   {
-    if(ArgumentParser::json_file == parser.TerminalMode())
-      cout << "Trivial column detected..." << endl;
-    N_columns = indexes.size();
+    MappedFile mapped;
+    if(mapped.Open(json_files[i]))
+    {
+      const char* it = mapped.Begin();
+      while(it < mapped.End() && done)
+      {
+        const char* end_of_line = static_cast<const char*>(memchr(it, '\n', mapped.End() - it));
+        if(!end_of_line)
+          end_of_line = mapped.End();
+        if(end_of_line - it >= 3)
+          property.ParseJSON(it, end_of_line, window);
+        if(window.N_records() >= window_size)
+          done = SendWindow(parser, manipulater, window, N_records);
+        it = end_of_line + 1;
+      }
+      continue;
+    }
+
+    // Not a regular file (e.g. a pipe): read line by line
+    ifstream in(json_files[i].c_str());
+    if(!in.is_open())
+    {
+      cerr << "Error openning json file |" << json_files[i] << "|..." << endl;
+      done = false;
+      break;
+    }
+    string line;
+    while(done && getline(in, line))
+    {
+      if(line.size() >= 3)
+        property.ParseJSON(line, window);
+      if(window.N_records() >= window_size)
+        done = SendWindow(parser, manipulater, window, N_records);
+    }
   }
-  if(0 == N_columns)
+  if(done)
+    done = SendWindow(parser, manipulater, window, N_records);
+  ReportRate(N_records, start);
+
+  if(done)
+    manipulater.Accepted();
+  return done;
+}
+
+// Send records of a window, and empty it
+bool OperationTool::SendWindow(const ArgumentParser& parser, MySQLOperator& manipulater, RecordsHolder& window, size_t& N_records) const
+{
+  vector<vector<string> > all_data;
+  window.Release(all_data);
+  if(all_data.empty())
+    return true;
+  size_t first_position = N_records;
+  N_records += all_data.size();
+
+  // Records committed by an earlier run are skipped
+  size_t first = 0;
+  if(parser.ResumeFrom() > first_position)
   {
-    cout << "All columns are trivial. Nothing to do." << endl;
+    first = parser.ResumeFrom() - first_position;
+    if(first >= all_data.size())
+      return true;
+  }
+
+  // Columns empty in this window are left out of its commands
+  vector<int> indexes;
+  NonEmptyColumns(all_data, parser.N_Columns(), indexes);
+  if(indexes.empty())
+  {
+    cout << "Warning... All columns are trivial in records " << first_position + first + 1
+         << "-" << N_records << ", skipped..." << endl;
+    for(size_t i=first;i<all_data.size();++i)
+      manipulater.FailedRecord();
     return true;
   }
 
-  // Create MySQLOperator for OperationTool and initiate the database
+  vector<size_t> records;
+  records.reserve(all_data.size() - first);
+  for(size_t i=first;i<all_data.size();++i)
+    records.push_back(i);
+  return Process(parser, manipulater, all_data, records, indexes, first_position);
+}
+
+// Reconciliation: only the differences between the records scanned and
+// those of the table are sent
+bool OperationTool::Reconcile(const ArgumentParser& parser) const
+{
+  size_t N_records = holder.N_records();
+  vector<vector<string> > all_data(N_records);
+  for(size_t i=0;i<N_records;++i)
+    holder.GetRecord(i, all_data[i]);
+  vector<int> indexes;
+  NonEmptyColumns(all_data, parser.N_Columns(), indexes);
+
   MySQLOperator manipulater(parser);
   if(!manipulater.InitiateDatabase())
   {
@@ -1030,6 +3458,55 @@ bool OperationTool::Run(const ArgumentParser& parser)
     return false;
   }
 
+  timeval start;
+  gettimeofday(&start, 0);
+  vector<size_t> inserted;
+  vector<size_t> updated;
+  vector<string> deleted;
+  if(!manipulater.Compare(all_data, inserted, updated, deleted))
+    return false;
+  size_t N_changes = inserted.size() + updated.size() + deleted.size();
+  string table(parser.Table());
+
+  // All or nothing: a failure of any step undoes all
+  bool done = true;
+
+  // Records gone: deleted by LFN, in batches
+  if(!deleted.empty())
+  {
+    int index_of_lfn = PropertyParser::GetInstance().GetIndex("lfn");
+    vector<vector<string> > gone(deleted.size(), vector<string>(parser.N_Columns()));
+    vector<size_t> records(deleted.size());
+    for(size_t i=0;i<deleted.size();++i)
+    {
+      gone[i][index_of_lfn].swap(deleted[i]);
+      records[i] = i;
+    }
+    done = manipulater.KeyDelete(gone, records, vector<int>(1, index_of_lfn), table, false);
+  }
+
+  // New records: inserted in batches
+  if(done && !inserted.empty())
+  {
+    int failed = manipulater.Failures();
+    done = Process(parser, manipulater, all_data, inserted, indexes) && manipulater.Failures() == failed;
+  }
+
+  // Records changed: updated by a join with a staging table, within the
+  // transaction of the others
+  if(done)
+    done = manipulater.BulkUpdate(all_data, updated, indexes, table, false);
+  ReportRate(N_changes, start);
+
+  if(done)
+    manipulater.Accepted();
+  return done;
+}
+
+// Handle records by one connection
+bool OperationTool::Process(const ArgumentParser& parser, MySQLOperator& manipulater, const vector<vector<string> >& all_data, const vector<size_t>& all_records, const vector<int>& indexes, size_t first_position) const
+{
+
   // Instantiate the real operator from insert/update/delete
   BaseCommand* command_generator = manipulater.Generate(indexes);
   if(!command_generator)
@@ -1040,44 +3517,109 @@ bool OperationTool::Run(const ArgumentParser& parser)
   else if(!command_generator->InitiateDatabase())
   {
     cerr << "Initiating MySQL command generator failed." << endl;
+    delete command_generator;
     return false;
   }
 
+  // Records already recorded are left out
+  vector<size_t> kept;
+  if(parser.SkippingExisting())
+    manipulater.SkipExisting(*command_generator, all_data, all_records, kept);
+  const vector<size_t>& records = parser.SkippingExisting() ? kept : all_records;
+  size_t N_records = records.size();
+
   // Ready to handle each record
-  if(indexes.size() == parser.N_Columns())
+  if(parser.BulkLoading() || parser.BulkUpdating() || parser.KeyDeleting())
   {
+    // Records of each table are loaded/updated/deleted at once
+    map<string, vector<size_t> > tables;
     for(size_t i=0;i<N_records;++i)
     {
-      try {
-        manipulater.OneRecord(command_generator->GetCommand(all_data[i]));
-      } catch(BadCommand& e) {
-        cout << "Warning... Can't generate command on " << i << "..." << endl;
+      string name_of_table(command_generator->TableOf(all_data[records[i]]));
+      if(name_of_table.empty())
         manipulater.FailedRecord();
+      else
+        tables[name_of_table].push_back(records[i]);
+    }
+    for(map<string, vector<size_t> >::const_iterator it = tables.begin(); it != tables.end(); ++it)
+    {
+      if(parser.BulkLoading())
+        manipulater.BulkLoad(all_data, it->second, indexes, it->first);
+      else if(parser.BulkUpdating())
+        manipulater.BulkUpdate(all_data, it->second, indexes, it->first);
+      else
+        manipulater.KeyDelete(all_data, it->second, indexes, it->first, 2 == parser.KeyDeleting());
+    }
+  }
+  else if(parser.Preparing())
+  {
+    // Values are bound, rather than joined into commands
+    for(size_t i=0;i<N_records;++i)
+    {
+      const vector<string>& one_record = all_data[records[i]];
+      string name_of_table(command_generator->TableOf(one_record));
+      if(name_of_table.empty())
+        manipulater.FailedRecord();
+      else
+        manipulater.PreparedRecord(one_record, name_of_table);
+      if(!manipulater.Checkpoint(first_position + records[i] + 1))
+      {
+        delete command_generator;
+        return false;
+      }
+    }
+  }
+  else if((ArgumentParser::insertion_mode == parser.OperationMode() || ArgumentParser::upsert_mode == parser.OperationMode()) &&
+          1 != parser.BatchSize())
+  {
+    // Records are routed to the queue of their table, "commit-every"
+    // records at a time so that each commit still ends at a position of
+    // the input
+    InsertionCommand& insertion = static_cast<InsertionCommand&>(*command_generator);
+    size_t chunk = parser.CommitEvery() ? size_t(parser.CommitEvery()) : N_records;
+    for(size_t begin=0;begin<N_records;begin+=chunk)
+    {
+      size_t end = min(N_records, begin + chunk);
+      map<string, vector<size_t> > tables;
+      for(size_t i=begin;i<end;++i)
+      {
+        string name_of_table(command_generator->TableOf(all_data[records[i]]));
+        if(name_of_table.empty())
+          manipulater.FailedRecord();
+        else
+          tables[name_of_table].push_back(records[i]);
+      }
+      for(map<string, vector<size_t> >::const_iterator it = tables.begin(); it != tables.end(); ++it)
+        manipulater.Enqueue(insertion, all_data, it->second, it->first);
+      if(!manipulater.Checkpoint(first_position + records[end-1] + 1, end - begin))
+      {
+        delete command_generator;
+        return false;
       }
     }
   }
   else
   {
+    // Empty columns are left out by the generator
     for(size_t i=0;i<N_records;++i)
     {
-      vector<string> a_record;
-      const vector<string>& one_record = all_data[i];
-      for(size_t j=0;j<N_columns;++j)
-        a_record.push_back(one_record[indexes[j]]);
       try {
-//      string this_record(command_generator->GetCommand(a_record);
-//      manipulater.OneRecord(this_record);
-        manipulater.OneRecord(command_generator->GetCommand(all_data[i]));
+        manipulater.OneRecord(command_generator->GetCommand(all_data[records[i]]));
       } catch(BadCommand& e) {
-        cout << "Warning... Can't generate command on " << i << "..." << endl;
+        cout << "Warning... Can't generate command on " << records[i] << "..." << endl;
         manipulater.FailedRecord();
       }
+      if(!manipulater.Checkpoint(first_position + records[i] + 1))
+      {
+        delete command_generator;
+        return false;
+      }
     }
   }
 
-  delete command_generator;
-  // If it gets here, ready to commit the modification.
-  manipulater.Accepted();
+  // Insertions still waiting
+  manipulater.Flush();
 
+  delete command_generator;
   return true;
 }
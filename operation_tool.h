@@ -19,12 +19,15 @@ public:
   void PrepareColumns(const ArgumentParser& parser);
 
   void ParseJSON(const std::string& value, RecordsHolder& holder) const;
+  void ParseJSON(const char* begin, const char* end, RecordsHolder& holder) const;
   void ParseString(const std::map<std::string, std::string>& buffer, RecordsHolder& holder) const;
   inline int GetIndex(const std::string& one_column) const
   {
     std::map<std::string, int>::const_iterator it = columns.find(one_column);
     return columns.end() == it ? -1 : it->second;
   }
+private:
+  void Insert(std::vector<std::string>& one_record, RecordsHolder& holder) const;
 };
 
 
@@ -36,18 +39,60 @@ public:
     insertion_mode,
     updating_mode,
     deletion_mode,
+    upsert_mode,
   };
   enum TerminalInputMode {
     nothing_sent,
     json_file,
     direct_input,
     separate_columns,
+    scanned_files,
   };
 private:
   RecordsHolder holder;
   int operation_mode;
   bool separate_tables;
   int terminal_mode;
+  // Maximal number of records in an insertion (0: as many as a packet holds)
+  int batch_size;
+  // Insert all records by "load data local infile"
+  bool bulk_loading;
+  // Insert records by prepared statements
+  bool preparing;
+  // Update records by a join with a staging table
+  bool bulk_updating;
+  // Delete records by LFN only, in batches (1), checking the other columns
+  // beforehand (2)
+  int key_deleting;
+  // Upsert by "replace" rather than "insert ... on duplicate key update"
+  bool replacing;
+  // Number of threads parsing JSON files or scanning (0: one for each core)
+  int threads;
+  // Number of connections (each with its own transaction) sharing records
+  int connections;
+  // Records per window when streaming JSON files (0: no streaming)
+  int stream_window;
+  // JSON files to be parsed
+  std::vector<std::string> json_files;
+  // Records per transaction (0: all in one)
+  int commit_every;
+  // File keeping the number of records committed
+  std::string journal;
+  // Records to skip, committed by an earlier run (with "resume")
+  size_t resume_from;
+  // Leave out records whose LFNs are already in the table (insertion only)
+  bool skipping_existing;
+  // File to write commands into, rather than sending them ("-": stdout)
+  std::string emit_sql;
+  // The standard output, if commands are written there (other messages of
+  // cout are then sent to cerr)
+  std::streambuf* standard_output;
+  // Apply only the differences between the files scanned and the table
+  bool reconciling;
+  // Directories scanned, as LFNs (with the prefix, ending with "/")
+  std::vector<std::string> scanned_roots;
+  // Manifest of files scanned (path, size, mtime, checksum) by the last run
+  std::string manifest;
 public:
   ArgumentParser();
   const RecordsHolder& Holder() const { return holder; }
@@ -55,8 +100,37 @@ public:
   int OperationMode() const { return operation_mode; }
   bool SeparateTables() const { return separate_tables; }
   int TerminalMode() const { return terminal_mode; }
+  int BatchSize() const { return batch_size; }
+  bool BulkLoading() const { return bulk_loading; }
+  bool Preparing() const { return preparing; }
+  bool BulkUpdating() const { return bulk_updating; }
+  int KeyDeleting() const { return key_deleting; }
+  bool Replacing() const { return replacing; }
+  int Connections() const { return connections; }
+  size_t StreamWindow() const { return stream_window; }
+  const std::vector<std::string>& JSONFiles() const { return json_files; }
+  int CommitEvery() const { return commit_every; }
+  size_t ResumeFrom() const { return resume_from; }
+  bool SkippingExisting() const { return skipping_existing; }
+  const std::string& EmitSQL() const { return emit_sql; }
+  std::streambuf* StandardOutput() const { return standard_output; }
+  bool Reconciling() const { return reconciling; }
+  const std::vector<std::string>& ScannedRoots() const { return scanned_roots; }
+
+  // Save into the journal that the first <committed> records are committed
+  // Returns false if it can't be saved
+  bool WriteJournal(size_t committed) const;
 private:
+  // Identity of the input, so that a journal isn't used for another input
+  std::string InputOfJournal() const;
+  // Read the number of records committed by an earlier run
+  bool ReadJournal();
   bool IngestDirectInput();
+  bool ExpandJSONFiles(const std::vector<std::string>& patterns);
+  // Threads to start: <threads>, or the number of cores
+  size_t WorkerThreads() const;
+  bool IngestJSONFiles();
+  bool IngestScannedFiles(const std::vector<std::string>& directories, const std::string& prefix, bool hashing);
   static const std::string separators[6];
   void InsertMap(const std::string& content, std::map<std::string, std::string>& target) const;
 };
@@ -83,65 +157,80 @@ private:
     int number_of_columns_for_query;
     // The names of all columns with contents
     std::vector<std::string> columns_for_query;
+    // Index in a record of each of columns_for_query
+    std::vector<int> indexes_for_query;
 
     // Expected name of the table (from terminal arguments)
     std::string table;
 
     // Enable dynamically change of table if true
     bool different_tables;
+    // Tables other than <table> already announced (with "multi-tables")
+    mutable std::set<std::string> other_tables;
+
+    // Writer of commands, whose buffer is kept between records
+    StatementBuilder builder;
 
   public:
-    BaseCommand(const ArgumentParser& parser, const std::vector<int>& wanted);
+    // <connection> is for escaping values in its character set
+    BaseCommand(const ArgumentParser& parser, const std::vector<int>& wanted, MySQLInterface* connection = 0);
     virtual ~BaseCommand();
 
-    // Ensure reliability of <table>, implement leading_words(s)
+    // Ensure reliability of <table>
     virtual bool InitiateDatabase() = 0;
-    virtual std::string GetCommand(const std::vector<std::string>& source) = 0;
+    // The command for a record, valid until the next call
+    virtual const std::string& GetCommand(const std::vector<std::string>& source) = 0;
 
-  protected:
-    void ModifyCommand(std::string& command) const
-    {
-      CommonModify(command);
-      SpecificModify(command);
-    }
-    // Change the format of <command>, for example, 'true' to 1.
-    void CommonModify(std::string& command) const;
-    virtual void SpecificModify(std::string& command) const = 0;
+    // Table to hold <one_record>: from its LFN, if accepted (the table from
+    // terminal, or any with "multi-tables"). Empty if rejected.
+    std::string TableOf(const std::vector<std::string>& one_record) const;
 
+  protected:
     bool ValidParameters(bool with_lfn = true) const;
     bool ValidTableName(const std::string& table_name) const;
     // Get time the moment it is called.
     std::string GetTime() const;
     std::string FindTable(const std::vector<std::string>& one_record) const;
-    bool BasicCommand(const std::vector<std::string>& one_record, std::string& command) const;
+    // Table of a record with all columns (or BadCommand thrown)
+    std::string TableOfCommand(const std::vector<std::string>& one_record) const throw(BadCommand);
   };
+  // Also for upsert: "insert ... on duplicate key update", or "replace"
   class InsertionCommand: public BaseCommand {
     std::string leading_words;
+    // Whether to update existing records by "on duplicate key update"
+    bool upserting;
+    // Columns of the command being written
+    std::string columns;
+    // "on duplicate key update" for the columns of the last command
+    std::string last_columns;
+    std::string last_tail;
   public:
-    InsertionCommand(const ArgumentParser& parser, const std::vector<int>& wanted);
+    InsertionCommand(const ArgumentParser& parser, const std::vector<int>& wanted, MySQLInterface* connection = 0);
     bool InitiateDatabase();
-    std::string GetCommand(const std::vector<std::string>& source) throw(BadCommand);
-  private:
-    void SpecificModify(std::string& command) const;
+    const std::string& GetCommand(const std::vector<std::string>& source) throw(BadCommand);
+
+    // Parts of an insertion of many records into <table>, common to them:
+    // "insert into <table> (<columns>) values ", and " on duplicate key
+    // update ..." (upsert only, empty otherwise)
+    void Head(const std::string& table, std::string& head, std::string& tail) const;
+    // "(<values>)" of a record, valid until the next call. All columns of the
+    // generator shall be filled (see NonEmptyColumns).
+    const std::string& Tuple(const std::vector<std::string>& source);
   };
   class UpdatingCommand: public BaseCommand {
     std::string leading_words_1;
     std::string leading_words_2;
   public:
-    UpdatingCommand(const ArgumentParser& parser, const std::vector<int>& wanted);
+    UpdatingCommand(const ArgumentParser& parser, const std::vector<int>& wanted, MySQLInterface* connection = 0);
     bool InitiateDatabase();
-    std::string GetCommand(const std::vector<std::string>& source) throw(BadCommand);
-  private:
-    void SpecificModify(std::string& command) const;
+    const std::string& GetCommand(const std::vector<std::string>& source) throw(BadCommand);
   };
   class DeletionCommand: public BaseCommand {
     std::string leading_words;
   public:
-    DeletionCommand(const ArgumentParser& parser, const std::vector<int>& wanted);
+    DeletionCommand(const ArgumentParser& parser, const std::vector<int>& wanted, MySQLInterface* connection = 0);
     bool InitiateDatabase();
-    std::string GetCommand(const std::vector<std::string>& source) throw(BadCommand);
-  private:
-    void SpecificModify(std::string& command) const;
+    const std::string& GetCommand(const std::vector<std::string>& source) throw(BadCommand);
   };
   // Database manipulater
   class MySQLOperator: MySQLInterface {
@@ -157,6 +246,31 @@ private:
     int the_mode;
     const ArgumentParser& parser;
     bool (MySQLOperator::*real_method)(const std::string&);
+
+    // Insertions waiting to be sent in one command
+    struct Batch {
+      // Common part of the commands: "insert into <table> (<columns>) values "
+      std::string head;
+      // " on duplicate key update ..." of the commands if any (upsert)
+      std::string tail;
+      // "(<values>)" of each record
+      std::vector<std::string> tuples;
+      // Size of the command joined by the batch
+      size_t bytes;
+      Batch(): bytes(0) {}
+    };
+    // Batches by table: records for each table wait in a queue of their own,
+    // so that mixed tables are batched as well as a single one
+    std::map<std::string, Batch> batches;
+    // Send the waiting insertions of one batch
+    void Flush(Batch& batch);
+
+    // Insertion by a prepared statement, for a table and a set of columns
+    class PreparedInsertion;
+    // Prepared statements, by "<table>:<indexes of columns>"
+    std::map<std::string, PreparedInsertion*> prepared;
+    // Names of all columns
+    std::vector<std::string> column_names;
   public:
     MySQLOperator(const ArgumentParser& p);
     ~MySQLOperator();
@@ -166,19 +280,127 @@ private:
     // Return true if all done, false if something wrong
     bool InitiateDatabase();
 
-    // Generate the MySQL query command generator
-    BaseCommand* Generate(const std::vector<int>& indexes) const;
+    // Generate the MySQL query command generator (escaping values by this
+    // connection)
+    BaseCommand* Generate(const std::vector<int>& indexes);
 
     // Insert one record into database each time
     void OneRecord(const std::string& the_command);
 
+    // Insert records (in 3) of <table> in batch: a record is kept until
+    // Flush() (called also when the batch of the table is full). The head
+    // of the batch is written once by <generator>, and each record adds only
+    // its values.
+    void Enqueue(InsertionCommand& generator, const std::vector<std::vector<std::string> >& data, const std::vector<size_t>& records, const std::string& table);
+
+    // Send the waiting insertions as one command. If it fails, they are sent
+    // one by one by OneRecord to find the one(s) failed.
+    void Flush();
+
+    // Insert records by "load data local infile", read from memory as a TSV
+    // file (no file created)
+    // Need 4 arguments:
+    //   1. all records
+    //   2. indexes of records (in 1) to load
+    //   3. indexes of columns to load
+    //   4. name of table
+    void BulkLoad(const std::vector<std::vector<std::string> >& data, const std::vector<size_t>& records, const std::vector<int>& indexes, const std::string& table);
+
+    // Insert a record by the prepared statement for <table> and its columns
+    // (the non-empty ones). A statement is prepared at its first use. Where
+    // array binding is available, records are kept (by address, so <record>
+    // shall live until Flush()) and sent by one execution.
+    void PreparedRecord(const std::vector<std::string>& record, const std::string& table);
+
+    // Update records by one "update ... join" with a staging table holding
+    // the new values, in chunks of "batch-size" LFNs (each committed at once
+    // with <committing>; otherwise left to the transaction of the caller)
+    // Need 5 arguments: the same as BulkLoad, and <committing>
+    // Return true if all records are updated
+    bool BulkUpdate(const std::vector<std::vector<std::string> >& data, const std::vector<size_t>& records, const std::vector<int>& indexes, const std::string& table, bool committing = true);
+
+    // Delete records by "delete from ... where lfn in (...)", as many LFNs by
+    // a command as a packet holds. With <verifying>, the other columns are
+    // matched as well, by "where (lfn, <c1>, ...) in (...)", so the server
+    // compares them (by their types and collations), as for one record.
+    // Need 5 arguments: the same as BulkLoad, and <verifying>
+    // Return true if all records are deleted
+    bool KeyDelete(const std::vector<std::vector<std::string> >& data, const std::vector<size_t>& records, const std::vector<int>& indexes, const std::string& table, bool verifying);
+
     // To confirm that all the records are to be inserted into database
     void Accepted(bool v = true) { accepted = v; }
 
+    // Commit the operations now, rather than when destructed. Returns false
+    // if the commit failed: the operations are undone then.
+    bool Commit();
+
     // Add the counts for failures
     void FailedRecord() { ++failure; }
+
+    // Counts of operations
+    int Successes() const { return success; }
+    int Failures() const { return failure; }
+
+    // Indexes (of <records>) of records whose LFNs aren't in their tables
+    // yet, found by "select lfn ... where lfn in (...)" in as few commands
+    // as possible. Those found are reported at once.
+    // Need 4 arguments:
+    //   1. generator of commands, finding the table of each record
+    //   2. all records
+    //   3. indexes of records (in 2) to check
+    //   4. indexes of those to handle (output)
+    void SkipExisting(const BaseCommand& generator, const std::vector<std::vector<std::string> >& data, const std::vector<size_t>& records, std::vector<size_t>& kept);
+
+    // Compare records scanned with those of the table under the directories
+    // scanned (by "select ... order by lfn", streamed and merged as the
+    // records arrive). Those differing on size or last_modified are to be
+    // updated. Returns false if the table can't be listed.
+    // Need 4 arguments:
+    //   1. all records scanned
+    //   2. indexes (of 1) of records not in the table (output)
+    //   3. indexes (of 1) of records changed (output)
+    //   4. LFNs of records in the table only (output)
+    bool Compare(const std::vector<std::vector<std::string> >& data, std::vector<size_t>& inserted, std::vector<size_t>& updated, std::vector<std::string>& deleted);
+
+    // Send a command controlling the transaction ("commit", etc.), or write
+    // it when emitting
+    bool Transaction(const std::string& command);
+
+    // Records up to <position> (of the input) have been handled. Every
+    // "commit-every" records, those waiting are sent, the transaction is
+    // committed, and <position> is saved into the journal. False if the
+    // commit failed: the work must stop there. <N_records> records have been
+    // handled since the last call.
+    bool Checkpoint(size_t position, size_t N_records = 1);
+  private:
+    // Whether committed (or undone) by Commit already
+    bool finished;
+    // Records handled since the last commit
+    size_t uncommitted;
+    // The position of input last reached
+    size_t reached;
+    // Where commands are written, rather than sent ("emit-sql")
+    std::ostream* emitted;
+    // Write a command into <emitted> (in place of Insert, etc.)
+    bool Emit(const std::string& the_command);
   };
+  // Records handled by a connection of their own, in background
+  class Shard;
+
   const RecordsHolder& holder;
+
+  // Handle <records> (indexes in <all_data>) by <manipulater>, with columns
+  // of <indexes> (those not empty). Returns false if commands can't be made.
+  // <first_position> is the position of all_data[0] in the whole input.
+  bool Process(const ArgumentParser& parser, MySQLOperator& manipulater, const std::vector<std::vector<std::string> >& all_data, const std::vector<size_t>& records, const std::vector<int>& indexes, size_t first_position = 0) const;
+  // Parse, send and release records of JSON files a window at a time
+  bool Stream(const ArgumentParser& parser) const;
+  // Insert, update and delete only the differences between the records
+  // scanned and the table
+  bool Reconcile(const ArgumentParser& parser) const;
+  // Send records of <window> by Process, and empty it. <N_records> counts
+  // the records sent.
+  bool SendWindow(const ArgumentParser& parser, MySQLOperator& manipulater, RecordsHolder& window, size_t& N_records) const;
 public:
   OperationTool(const RecordsHolder& h);
 
@@ -18,6 +18,9 @@
 #include <algorithm>
 #include <functional>
 #include <ctime>
+#include <cstdlib>
+#include <cstring>	// For memchr
+#include <cctype>	// For isspace
 using namespace std;
 
 namespace {
@@ -29,8 +32,127 @@ namespace {
         one_column.assign("NULL");
     }
   };
+
+  // Print the first column of each record streamed from database, one per
+  // line, to the screen and/or a file
+  class Listing: public MySQLInterface::RowReceiver {
+    ostream* screen;
+    ostream* file;
+  public:
+    Listing(ostream* s, ostream* f): screen(s), file(f) {}
+    void operator()(vector<string>& one_set)
+    {
+      if(screen)
+        *screen << one_set.front() << '\n';
+      if(file)
+        *file << one_set.front() << '\n';
+    }
+  };
+
+  // Pass each record streamed from database to a RecordsHolder
+  class Collecting: public MySQLInterface::RowReceiver {
+    RecordsHolder& holder;
+  public:
+    Collecting(RecordsHolder& h): holder(h) {}
+    void operator()(vector<string>& one_set)
+    {
+      // Transform the record by replacing NULL with a string "NULL".
+      for_each(one_set.begin(), one_set.end(), Replacing());
+      holder.Insert(one_set);
+    }
+  };
+
+  // Order of ranges by their low edges (unlimited ones first)
+  class LowerEdge {
+    bool numeric;
+  public:
+    LowerEdge(bool n): numeric(n) {}
+    bool operator()(const Conditions& a, const Conditions& b) const
+    {
+      if(a.LowUnlimited() || b.LowUnlimited())
+        return !b.LowUnlimited();
+      return 0 > Conditions::CompareEdges(a.LowEdge(), b.LowEdge(), numeric);
+    }
+  };
+
+  // Order of single values
+  class LowerValue {
+    bool numeric;
+  public:
+    LowerValue(bool n): numeric(n) {}
+    bool operator()(const string& a, const string& b) const
+    { return 0 > Conditions::CompareEdges(a, b, numeric); }
+  };
+}
+
+
+// ===> ConditionNode <===
+// Expression tree of MySQL conditions
+// Constructor
+ConditionNode::ConditionNode(int node_type, const string& leaf_expression):
+  type(node_type),
+  expression(leaf_expression),
+  children()
+{
+  if(Leaf != type && !expression.empty())
+  {
+    cerr << "Warning... Expression |" << expression << "| of a group omitted..." << endl;
+    expression.clear();
+  }
 }
 
+// Add a node into this group
+void ConditionNode::Add(const ConditionNode& child)
+{
+  if(Leaf == type)
+  {
+    cerr << "Can't add a condition into a leaf |" << expression << "|..." << endl;
+    return;
+  }
+  if(child.Empty())
+    return;
+
+  if(child.type == type)
+    children.insert(children.end(), child.children.begin(), child.children.end());
+  else if(Leaf != child.type && 1 == child.children.size())
+    Add(child.children.front());
+  else
+    children.push_back(child);
+}
+
+// Testing if there is any condition
+bool ConditionNode::Empty() const
+{
+  if(Leaf == type)
+    return expression.empty();
+  return children.empty();
+}
+
+// Convert the tree into a MySQL condition
+string ConditionNode::Output() const
+{
+  if(Leaf == type)
+    return expression;
+  if(children.empty())
+    return "";
+  if(1 == children.size())
+    return children.front().Output();
+
+  vector<string> all_children;
+  all_children.reserve(children.size());
+  for(vector<ConditionNode>::const_iterator it = children.begin(); it != children.end(); ++it)
+  {
+    // Members in a group are always of different type (flattened), so groups
+    // inside need parentheses.
+    if(Leaf == it->type)
+      all_children.push_back(it->Output());
+    else
+      all_children.push_back("(" + it->Output() + ")");
+  }
+  return boost::join(all_children, AndGroup == type ? " and " : " or ");
+}
+
+
 // ===> Conditions::BadGeneration <===
 // Exception class used in case of bad generation
 // Common constructor
@@ -86,6 +208,34 @@ Conditions::Conditions(const string& name, const string& low, const string& high
   ValidateCondition();
 }
 
+// Compare two edges. Quotes are omitted. With <numeric>, every edge is taken
+// by its value, so that the order is the same for all edges of a column.
+int Conditions::CompareEdges(const string& a, const string& b, bool numeric)
+{
+  string first(boost::erase_all_copy(a, "'"));
+  string second(boost::erase_all_copy(b, "'"));
+  if(!numeric)
+    return first.compare(second);
+
+  double first_v = strtod(first.c_str(), 0);
+  double second_v = strtod(second.c_str(), 0);
+  return first_v < second_v ? -1 : (first_v > second_v ? 1 : 0);
+}
+
+// Whether both edges (quotes omitted) are numbers
+bool Conditions::NumericEdges(const string& a, const string& b)
+{
+  string first(boost::erase_all_copy(a, "'"));
+  string second(boost::erase_all_copy(b, "'"));
+  if(first.empty() || second.empty())
+    return false;
+  char* first_end = 0;
+  char* second_end = 0;
+  strtod(first.c_str(), &first_end);
+  strtod(second.c_str(), &second_end);
+  return '\0' == *first_end && '\0' == *second_end;
+}
+
 Conditions::Conditions(const string& name, double low, double high):
   state_of_this_class(false),
   title(name)
@@ -108,14 +258,21 @@ bool Conditions::ValidateCondition()
   if(!ValidCondition())
     return false;
 
-  if(low_edge > high_edge)
+  if(!LowUnlimited() && !HighUnlimited() &&
+     0 < CompareEdges(low_edge, high_edge, NumericEdges(low_edge, high_edge)))
     std::swap(low_edge, high_edge);
 
   if(Conditions::function_pool.end() != Conditions::function_pool.find(title))
   {
     string_processer processor = Conditions::function_pool[title];
-    (this->*processor)(low_edge);
-    (this->*processor)(high_edge);
+    // Unlimited edges need no processing
+    if(!LowUnlimited())
+      (this->*processor)(low_edge);
+    if(!HighUnlimited())
+      (this->*processor)(high_edge);
+    // In case that processors reject an edge
+    if(!ValidCondition())
+      return false;
   }
 
   return state_of_this_class = true;
@@ -125,7 +282,7 @@ bool Conditions::ValidateCondition()
 // To convert the unit of size from MB to B
 void Conditions::ProcessSize(std::string& target_string)
 {
-  double target_v = atof(target_string.c_str());
+  double target_v = atof(boost::erase_all_copy(target_string, "'").c_str());
   target_v *= (1 << 20);
   ostringstream os;
   os << target_v;
@@ -155,7 +312,7 @@ void Conditions::ProcessDate(string& target_date)
     else
     {
       cerr << "Illegal date received: |" << initial << "|(" << target_date << ")(NUMBER). Remove it." << endl;
-      target_date.assign(unlimited);
+      target_date.clear();
       return;
     }
   }
@@ -167,7 +324,7 @@ void Conditions::ProcessDate(string& target_date)
     if(string::npos == underline)
     {
       cerr << "Illegal date received: |" << initial << "|(" << target_date << ")(UNDERLINE). Remove it." << endl;
-      target_date.assign(unlimited);
+      target_date.clear();
       return;
     }
     if(15 != N_chars)
@@ -184,7 +341,7 @@ void Conditions::ProcessDate(string& target_date)
   if(15 != N_chars)
   {
     cerr << "Illegal date received: |" << initial << "|(" << target_date << ")(OUTSIDE). Remove it." << endl;
-    target_date.assign(unlimited);
+    target_date.clear();
     return;
   }
   initial.assign(target_date);
@@ -232,7 +389,8 @@ bool Conditions::ValidCondition() const
     return false;
   }
 
-  if(unlimited == low_edge || unlimited == high_edge)
+  // At most one of the edges could be unlimited
+  if(unlimited == low_edge && unlimited == high_edge)
     return false;
 
   return true;
@@ -257,6 +415,16 @@ string Conditions::Output(Conditions::AndState concatenation) const
     results.append(" = ");
     results.append(low_edge);
   }
+  else if(LowUnlimited())
+  {
+    results.append(" <= ");
+    results.append(high_edge);
+  }
+  else if(HighUnlimited())
+  {
+    results.append(" >= ");
+    results.append(low_edge);
+  }
   else
   {
     results.append(" between ");
@@ -278,9 +446,14 @@ void Conditions::Convert(double v, string& s)
   s.assign(os.str());
 }
 
-// To turn string into 'string' (add quotes)
+// To turn string into 'string' (add quotes). UNLIMITED is kept as it is.
 inline void Conditions::AddQuote(const string& source, string& s)
 {
+  if(unlimited == source)
+  {
+    s.assign(unlimited);
+    return;
+  }
   s.assign("'");
   s.append(source);
   s.append("'");
@@ -326,12 +499,12 @@ Conditions Conditions::Factory(const string& hint) throw(BadGeneration)
     }
 
     size_t hyphen = count(low.begin(), low.end(), '-');
-    if(1 == hyphen)	// Only Low-High
-      hyphen = low.find("-");
-    else if('-' == *low.begin())	// <-High>
+    if('-' == *low.begin())	// <-High>
       hyphen = 0;
     else if('-' == *low.rbegin())	// <Low->
       hyphen = low.size();
+    else if(1 == hyphen)	// Only Low-High
+      hyphen = low.find("-");
     else if(hyphen%2)	// Hyphen in Low & High: the same format required
     {
       boost::iterator_range<string::iterator> it = boost::find_nth(low, "-", (hyphen-1)/2);
@@ -357,41 +530,39 @@ Conditions Conditions::Factory(const string& hint) throw(BadGeneration)
     }
   }
 
-  if(low < high)
+  if(0 > CompareEdges(low, high, NumericEdges(low, high)))
     return Conditions(title, low, high);
   else
     return Conditions(title, high, low);
 }
 
 // Handles the comment (a column in the table of database)
-void Conditions::CommentConditions(int comment_status, string& command)
+// Returns the conditions on comments (empty if unlimited)
+ConditionNode Conditions::CommentConditions(int comment_status)
 {
   if(UnlimitedComments == comment_status)
-    return;
+    return ConditionNode();
   if(0 > comment_status || 2 < comment_status)
   {
     cout << "Warning... Illegal status of comment received: " << comment_status << endl;
-    return;
+    return ConditionNode();
   }
 
-
   if(WithoutCommentsOnly == comment_status)
   {
-    vector<string> conditions(3);
-    conditions[0].assign("error_code = '0'");
-    conditions[1].assign("comment in ('NULL', 'NONE', '')");
-    conditions[2].assign("good = '1'");
-    command.append(boost::join(conditions, " and "));
+    ConditionNode conditions(ConditionNode::AndGroup);
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "error_code = '0'"));
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "comment in ('NULL', 'NONE', '')"));
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "good = '1'"));
+    return conditions;
   }
   else
   {
-    vector<string> conditions(3);
-    conditions[0].assign("error_code <> '0'");
-    conditions[1].assign("comment not in ('NULL', 'NONE', '')");
-    conditions[2].assign("good = '0'");
-    command.append(" (");
-    command.append(boost::join(conditions, " or "));
-    command.append(") ");
+    ConditionNode conditions(ConditionNode::OrGroup);
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "error_code <> '0'"));
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "comment not in ('NULL', 'NONE', '')"));
+    conditions.Add(ConditionNode(ConditionNode::Leaf, "good = '0'"));
+    return conditions;
   }
 }
 
@@ -400,12 +571,116 @@ const string Conditions::unlimited = "UNLIMITED";
 map<string, Conditions::string_processer> Conditions::function_pool;
 
 
+// ===> ColumnRanges <===
+// All conditions of a column
+// Constructor
+ColumnRanges::ColumnRanges(const string& name, bool numeric_column):
+  title(name),
+  numeric(numeric_column),
+  ranges(),
+  values()
+{}
+
+// Take in a (valid) condition
+bool ColumnRanges::Add(const Conditions& one_condition)
+{
+  if(title != one_condition.Title() || !one_condition.ValidCondition())
+    return false;
+
+  if(one_condition.SingleValue())
+    values.push_back(one_condition.LowEdge());
+  else
+    ranges.push_back(one_condition);
+  return true;
+}
+
+// Merge overlapping ranges, remove repeated values and values inside ranges
+void ColumnRanges::Merge()
+{
+  if(!ranges.empty())
+  {
+    // Edges ordered when parsed are ordered again the way of this column
+    for(size_t i=0;i<ranges.size();++i)
+    {
+      Conditions& one_range = ranges[i];
+      if(!one_range.LowUnlimited() && !one_range.HighUnlimited() &&
+         0 < Conditions::CompareEdges(one_range.low_edge, one_range.high_edge, numeric))
+        std::swap(one_range.low_edge, one_range.high_edge);
+    }
+    sort(ranges.begin(), ranges.end(), LowerEdge(numeric));
+    vector<Conditions> merged(1, ranges.front());
+    for(size_t i=1;i<ranges.size();++i)
+    {
+      Conditions& last = merged.back();
+      const Conditions& one_range = ranges[i];
+      // Ranges are sorted, so the only question is whether this one starts
+      // before the last one ends.
+      if(last.HighUnlimited())
+        break;
+      if(one_range.LowUnlimited() ||
+         0 >= Conditions::CompareEdges(one_range.low_edge, last.high_edge, numeric))
+      {
+        if(one_range.HighUnlimited() ||
+           0 < Conditions::CompareEdges(one_range.high_edge, last.high_edge, numeric))
+          last.high_edge.assign(one_range.high_edge);
+      }
+      else
+        merged.push_back(one_range);
+    }
+    ranges.swap(merged);
+  }
+
+  if(values.empty())
+    return;
+  sort(values.begin(), values.end(), LowerValue(numeric));
+  vector<string> remained;
+  remained.reserve(values.size());
+  for(size_t i=0;i<values.size();++i)
+  {
+    const string& one_value = values[i];
+    if(!remained.empty() && 0 == Conditions::CompareEdges(remained.back(), one_value, numeric))
+      continue;
+    bool covered = false;
+    for(size_t j=0;j<ranges.size() && !covered;++j)
+    {
+      covered =
+        (ranges[j].LowUnlimited() || 0 <= Conditions::CompareEdges(one_value, ranges[j].low_edge, numeric)) &&
+        (ranges[j].HighUnlimited() || 0 >= Conditions::CompareEdges(one_value, ranges[j].high_edge, numeric));
+    }
+    if(!covered)
+      remained.push_back(one_value);
+  }
+  values.swap(remained);
+}
+
+// Convert all conditions into a group joined by logical OR
+ConditionNode ColumnRanges::Output()
+{
+  Merge();
+
+  ConditionNode this_column(ConditionNode::OrGroup);
+  for(vector<Conditions>::const_iterator it = ranges.begin(); it != ranges.end(); ++it)
+    this_column.Add(ConditionNode(ConditionNode::Leaf, it->Output()));
+
+  if(1 == values.size())
+    this_column.Add(ConditionNode(ConditionNode::Leaf, title + " = " + values.front()));
+  else if(1 < values.size())
+    this_column.Add(ConditionNode(ConditionNode::Leaf, title + " in (" + boost::join(values, ", ") + ")"));
+
+  return this_column;
+}
+
+
 // ===> ArgumentParser <===
 // Arguments (if any) parser for SelectionTool
 // Constructor
 ArgumentParser::ArgumentParser():
   print_level(-1),
-  comment_status(Conditions::UnlimitedComments)
+  comment_status(Conditions::UnlimitedComments),
+  file_hints(ConditionNode::OrGroup),
+  counting(false),
+  lfn_only(false),
+  standard_output(0)
 {}
 
 // This is where terminal arguments are parsed.
@@ -442,6 +717,12 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     ("output,O", value<string>(), "Save the output into this file")
     ("redirect,R", value<string>(), "Only save the output into this file")
     ("filename,f", value<vector<string> >()->multitoken()->composing(), "Name (hints) of root file (\"*\" accepted)")
+    ("lfn-list,F", value<string>(), "File of LFNs (one per line) to look up")
+    ("count", "Print the number of files only (counted by the server)")
+    ("sum", value<string>(), "Print sums of these columns (e.g. size,nevts)")
+    ("group-by", value<string>(), "Count/sum for each value of these columns")
+    ("columns", value<string>(), "Select exactly these columns (e.g. lfn,size)")
+    ("lfn-only", "Print LFNs only as a plain list, one per line")
     ("print-level", value<int>()->default_value(-1), "Items to print (the lower the more)")
     ("comment-state,C", value<int>()->default_value(Conditions::WithoutCommentsOnly), "0: no comment; 1: with comment; 2: not-limited")
     ("comment-required", "Only print records with comments (comment-state=1)")
@@ -495,6 +776,11 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     }
   }
 
+  // A plain list of LFNs, e.g. to be redirected into a file, is all that
+  // stdout receives
+  if(vm.count("lfn-only") && !vm.count("count") && !vm.count("sum") && !vm.count("group-by"))
+    standard_output = cout.rdbuf(cerr.rdbuf());
+
   // Initiate the map, pairs of key(item)-value(content modifier)
   Conditions::MapInitiater::InitiateMap();
 
@@ -563,16 +849,29 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     print_level = -1;
   }
 
-  // Take in each condition
+  // Take in each condition. Several ranges or values of a column are
+  // separated by commas.
   for(set<string>::const_iterator it = FactoryInitializer::GetInstance().title_begin(); it != FactoryInitializer::GetInstance().title_end(); ++it)
   {
     if(!vm.count(*it))
       continue;
 
-    string info(*it);
-    info.append("=");
-    info.append(vm[*it].as<string>());
-    conditions.push_back(Conditions::Factory(info));
+    vector<string> pieces;
+    boost::split(pieces, vm[*it].as<string>(), boost::is_any_of(","), boost::token_compress_on);
+    for(vector<string>::const_iterator piece = pieces.begin(); piece != pieces.end(); ++piece)
+    {
+      if(piece->empty())
+        continue;
+      string info(*it);
+      info.append("=");
+      info.append(*piece);
+      try {
+        conditions.push_back(Conditions::Factory(info));
+      } catch(Conditions::BadGeneration& e) {
+        cerr << "Illegal condition |" << info << "|: " << e.what() << endl;
+        return 2;
+      }
+    }
   }
 
   // Remove invalid conditions if any
@@ -593,29 +892,33 @@ int ArgumentParser::Parse(int argc, const char* argv[])
     if(filename.empty())
       cout << "Warning... Trivial file name received..." << endl;
     else
-    {
-      for(vector<string>::iterator it = filename.begin(); it != filename.end(); ++it)
-      {
-        // If there is a star, replace it with "%", MySQL version for "*".
-        if(string::npos == (*it).find("*"))
-          (*it).insert(0, " lfn = '");
-        else
-        {
-          boost::replace_all(*it, "*", "%");
-          (*it).insert(0, " lfn like '");
-        }
-        (*it).append("'");
-      }
-      // Store the file hint(s)
-      if(1 == filename.size())
-        file_hints.assign(filename[0]);
-      else
-      {
-        file_hints.assign("(");
-        file_hints.append(boost::join(filename, " or "));
-        file_hints.append(")");
-      }
-    }
+      AddFileHints(filename);
+  }
+
+  // For a (long) list of exact LFNs
+  if(vm.count("lfn-list") && !ReadLFNList(vm["lfn-list"].as<string>()))
+    return 2;
+
+  // Summaries instead of records
+  counting = vm.count("count");
+  if(vm.count("sum") && !RealColumns(vm["sum"].as<string>(), sum_columns))
+    return 2;
+  if(vm.count("group-by") && !RealColumns(vm["group-by"].as<string>(), group_columns))
+    return 2;
+  // Files are counted for each group if nothing else is wanted
+  if(!group_columns.empty() && sum_columns.empty())
+    counting = true;
+
+  // Columns to select. LFN is always selected, for it identifies a record.
+  lfn_only = vm.count("lfn-only");
+  if(lfn_only)
+    projected_columns.assign(1, "lfn");
+  else if(vm.count("columns"))
+  {
+    if(!RealColumns(vm["columns"].as<string>(), projected_columns))
+      return 2;
+    if(projected_columns.end() == find(projected_columns.begin(), projected_columns.end(), "lfn"))
+      projected_columns.insert(projected_columns.begin(), "lfn");
   }
 
   return 0;
@@ -625,53 +928,40 @@ int ArgumentParser::Parse(int argc, const char* argv[])
 // There is a "WHERE" in the string returned.
 string ArgumentParser::MySQLCommand() const
 {
-  // Number of conditions other than comments and file names
-  size_t N = N_conditions();
-  if(0 == N &&
-     Conditions::UnlimitedComments == comment_status &&
-     file_hints.empty())
-  {
-    // No conditions at all.
-    cout << "Empty condition..." << endl;
-    return "";
-  }
+  // All conditions are joined by logical AND
+  ConditionNode all_conditions(ConditionNode::AndGroup);
 
-  string common_command;
-  Conditions::CommentConditions(comment_status, common_command);
-  if(0 == N)
-  {
-    // If there is no condition for the fields other than comments and file
-    // names, add the conditions for the latter two if any, and returns.
-    if(!common_command.empty())
-      common_command.insert(0, " where ");
-    AddFileHint(common_command);
-    return common_command;
-  }
+  // Use file hints as the first condition for efficiency concerns.
+  all_conditions.Add(file_hints);
 
-  string command(" where ");
-  // To construct the concatenation of all other conditions
-  if(1 == N)
-    command.append(conditions.front().Output(Conditions::Neither));
-  else
+  // Conditions on the same column are joined by logical OR
+  vector<ColumnRanges> columns;
+  for(vector<Conditions>::const_iterator it = conditions.begin(); it != conditions.end(); ++it)
   {
-    --N;
-    for(size_t i=0;i<N;++i)
-      command.append(conditions[i].Output(Conditions::OnlyTail));
-    command.append(conditions[N].Output(Conditions::Neither));
+    size_t i = 0;
+    while(i < columns.size() && !columns[i].Add(*it))
+      ++i;
+    if(columns.size() == i)
+    {
+      columns.push_back(ColumnRanges(it->Title(), NumericColumn(it->Title())));
+      columns.back().Add(*it);
+    }
   }
+  for(vector<ColumnRanges>::iterator it = columns.begin(); it != columns.end(); ++it)
+    all_conditions.Add(it->Output());
 
-  // To add the comment condition to the final comment.
-  if(!common_command.empty())
+  // Conditions on comments
+  all_conditions.Add(Conditions::CommentConditions(comment_status));
+
+  if(all_conditions.Empty())
   {
-    command.append(" and ");
-    command.append(common_command);
+    // No conditions at all.
+    cout << "Empty condition..." << endl;
+    return "";
   }
 
-  // Add the file name condition.
-  AddFileHint(command);
-
   // Return the concatenation of all conditions
-  return command;
+  return " where " + all_conditions.Output();
 }
 
 // Output the name of columns according to the level
@@ -688,7 +978,14 @@ void ArgumentParser::Columns(vector<string>& target, int level) const
     return;
 
   if(-2 == level)
+  {
+    if(!projected_columns.empty())
+    {
+      target.assign(projected_columns.begin(), projected_columns.end());
+      return;
+    }
     level = print_level;
+  }
   else if(3 < level || -2 > level)
     return;
 
@@ -708,6 +1005,65 @@ string ArgumentParser::ColumnNames(int level) const
   return boost::join(target, ", ");
 }
 
+// Names of columns of summaries: grouping columns, number of files, sums
+void ArgumentParser::AggregationNames(vector<string>& target) const
+{
+  target.assign(group_columns.begin(), group_columns.end());
+  if(counting)
+    target.push_back("files");
+  for(vector<string>::const_iterator it = sum_columns.begin(); it != sum_columns.end(); ++it)
+    target.push_back("sum(" + *it + ")");
+}
+
+// Items to select for summaries
+string ArgumentParser::AggregationColumns() const
+{
+  vector<string> target(group_columns);
+  if(counting)
+    target.push_back("count(*)");
+  for(vector<string>::const_iterator it = sum_columns.begin(); it != sum_columns.end(); ++it)
+    target.push_back("sum(" + *it + ")");
+  return boost::join(target, ", ");
+}
+
+// Items to group by
+string ArgumentParser::GroupingColumns() const
+{
+  return boost::join(group_columns, ", ");
+}
+
+// Convert a list of columns separated by commas into names of columns in the
+// table (case insensitive)
+// Returns false if any of them is not a column
+bool ArgumentParser::RealColumns(const string& hint, vector<string>& target) const
+{
+  vector<string> pieces;
+  boost::split(pieces, hint, boost::is_any_of(","), boost::token_compress_on);
+  for(vector<string>::iterator it = pieces.begin(); it != pieces.end(); ++it)
+  {
+    boost::trim(*it);
+    if(it->empty())
+      continue;
+    size_t i = 0;
+    while(i < number_of_columns && !boost::iequals(*it, name_of_columns[i]))
+      ++i;
+    if(number_of_columns == i)
+    {
+      cerr << "Error! No column |" << *it << "| in " << Table() << "..." << endl;
+      return false;
+    }
+    if(target.end() == find(target.begin(), target.end(), name_of_columns[i]))
+      target.push_back(name_of_columns[i]);
+  }
+
+  if(target.empty())
+  {
+    cerr << "Error! No column in |" << hint << "|..." << endl;
+    return false;
+  }
+  return true;
+}
+
 // Set output file
 bool ArgumentParser::SetOutputFile(const string& filename, bool surpress)
 {
@@ -738,36 +1094,88 @@ bool ArgumentParser::SetOutputFile(const string& filename, bool surpress)
   }
 }
 
-// Add conditions concerning about filenames
-void ArgumentParser::AddFileHint(string& command) const
+// Read LFNs from a file, one per line. Blank lines and repetitions are
+// omitted.
+// Returns false if the file is unreadable or if there is no LFN inside
+bool ArgumentParser::ReadLFNList(const string& filename)
 {
-  if(file_hints.empty())
-    return;
-
-  if(command.empty())
+  set<string> unique_lfn;
+  size_t N_lines = 0;
+  MappedFile in;
+  if(!in.Open(filename))
   {
-    // In case of empty command
-    command.assign(" where ");
-    command.append(file_hints);
+    // Not a regular file (e.g. a pipe): read line by line
+    ifstream piped(filename.c_str());
+    if(!piped.is_open())
+    {
+      cerr << "Can't open the list of LFN |" << filename << "|..." << endl;
+      return false;
+    }
+    string line;
+    while(getline(piped, line))
+    {
+      boost::trim(line);
+      if(line.empty())
+        continue;
+      ++N_lines;
+      if(unique_lfn.insert(line).second)
+        lfn_list.push_back(line);
+    }
   }
-  else if(string::npos == command.find(" where ") &&
-          string::npos == command.find("where "))
+  for(const char* it = in.Begin(); it < in.End();)
   {
-    // <command> is a command, but no "where" inside (no conditions added)
-    string the_beginning(" where ");
-    the_beginning.append(file_hints);
-    the_beginning.append(" and ");
-    command.append(the_beginning);
+    const char* end_of_line = static_cast<const char*>(memchr(it, '\n', in.End() - it));
+    if(!end_of_line)
+      end_of_line = in.End();
+    const char* next = end_of_line + 1;
+    // Trimmed in place
+    while(it < end_of_line && isspace(static_cast<unsigned char>(*it)))
+      ++it;
+    while(it < end_of_line && isspace(static_cast<unsigned char>(end_of_line[-1])))
+      --end_of_line;
+    if(it < end_of_line)
+    {
+      ++N_lines;
+      string line(it, end_of_line);
+      if(unique_lfn.insert(line).second)
+        lfn_list.push_back(line);
+    }
+    it = next;
   }
-  else
+
+  if(lfn_list.empty())
   {
-    // <command> is a command with conditions (" where <condition 1>, ...")
-    string the_beginning("where ");
-    the_beginning.append(file_hints);
-    the_beginning.append(" and ");
-    // Use file hints as the first condition for efficiency concerns.
-    boost::replace_first(command, "where ", the_beginning);
+    cerr << "No LFN found in |" << filename << "|..." << endl;
+    return false;
   }
+  if(N_lines != lfn_list.size())
+    cout << "Warning... " << N_lines - lfn_list.size() << " repeated LFN(s) in |" << filename << "| omitted..." << endl;
+  return true;
+}
+
+// Add conditions concerning about filenames. Exact names are collected into
+// an "in" list, and names with "*" are matched by "like".
+void ArgumentParser::AddFileHints(vector<string>& filename)
+{
+  vector<string> exact_names;
+  for(vector<string>::iterator it = filename.begin(); it != filename.end(); ++it)
+  {
+    if(it->empty())
+      continue;
+    // If there is a star, replace it with "%", MySQL version for "*".
+    if(string::npos == it->find("*"))
+      exact_names.push_back("'" + *it + "'");
+    else
+    {
+      boost::replace_all(*it, "*", "%");
+      file_hints.Add(ConditionNode(ConditionNode::Leaf, "lfn like '" + *it + "'"));
+    }
+  }
+
+  if(1 == exact_names.size())
+    file_hints.Add(ConditionNode(ConditionNode::Leaf, "lfn = " + exact_names.front()));
+  else if(1 < exact_names.size())
+    file_hints.Add(ConditionNode(ConditionNode::Leaf, "lfn in (" + boost::join(exact_names, ", ") + ")"));
 }
 
 
@@ -827,48 +1235,102 @@ void FactoryInitializer::InsertTitle(const string& title)
 // Constructor
 SelectionTool::SelectionTool():
   MySQLInterface(),
-  holder()
+  holder(),
+  N_listed(0),
+  aggregating(false),
+  listing_only(false),
+  standard_output(0)
 {}
 
 // Initiate the database connection, initiate the RecordsHolder, find the MySQL
 // (selection) query command
 bool SelectionTool::InitiateDatabase(const ArgumentParser& parser)
 {
-  if(!connectMySQL(parser.Server().c_str(), parser.User().c_str(), parser.Passwd().c_str(), (database = parser.Database()).c_str(), parser.Port()))
+  if(!connectMySQL(parser.Address().c_str(), parser.User().c_str(), parser.Passwd().c_str(), (database = parser.Database()).c_str(), parser.Port()))
   {
     cerr << "Connection failed!" << endl;
     return false;
   }
+  // Conditions were parsed with the cached structure of table, if any
+  if(!parser.SchemaConfirmed())
+    return false;
 
-  if(!holder.Initialize(parser))
+  aggregating = parser.Aggregating();
+  vector<string> summary_names;
+  if(aggregating)
+    parser.AggregationNames(summary_names);
+  // No check of repetition here: summaries are unique, so are records if LFN
+  // is a unique key. Otherwise the server is asked to remove the repetition
+  // ("select distinct").
+  bool unique_lfn = aggregating || parser.UniqueColumn("lfn");
+  holder.DetectDuplicates(false);
+  if(!(aggregating ? holder.Initialize(summary_names) : holder.Initialize(parser)))
   {
     cerr << "Error initiating buffer..." << endl;
     return false;
   }
 
+  // LFNs given exactly are joined against the catalog in the server
+  table.assign(parser.Table());
+  if(!parser.LFNList().empty() && !LoadLFNList(parser.LFNList()))
+  {
+    cerr << "Error loading the list of LFN..." << endl;
+    return false;
+  }
+
   // Use print level to select the columns wanted.
   int level = parser.PrintLevel();
-  if(-1 == level)
-    command.assign("select * from ");
-  else
+  if(aggregating)
   {
     command.assign("select ");
+    command.append(parser.AggregationColumns());
+    command.append(" from ");
+  }
+  else if(-1 == level && !parser.Projecting())
+  {
+    command.assign(unique_lfn ? "select " : "select distinct ");
+    // Columns of the temporary table are not wanted
+    if(N_listed)
+      command.append(table + ".");
+    command.append("* from ");
+  }
+  else
+  {
+    command.assign(unique_lfn ? "select " : "select distinct ");
     command.append(parser.ColumnNames());
     command.append(" from ");
   }
 
   // Append table to the command
-  command.append(parser.Table());
+  command.append(table);
+  if(N_listed)
+  {
+    command.append(" join ");
+    command.append(lfn_list_table);
+    command.append(" on lfn = wanted_lfn");
+  }
 
   // Append conditions.
   string conditions(parser.MySQLCommand());
-  if(conditions.empty())
-    cerr << "Warning... No conditions detected: printing all" << endl;
-  else
+  if(!conditions.empty())
     command.append(conditions);
+  else if(!N_listed && !aggregating)
+    cerr << "Warning... No conditions detected: printing all" << endl;
+
+  // Records are summarized by the server
+  string grouping(parser.GroupingColumns());
+  if(aggregating && !grouping.empty())
+  {
+    command.append(" group by ");
+    command.append(grouping);
+    command.append(" order by ");
+    command.append(grouping);
+  }
 
   output.assign(parser.Output());
   surpressing = parser.Surpressing();
+  listing_only = parser.LFNOnly() && !aggregating;
+  standard_output = parser.StandardOutput();
 
   return true;
 }
@@ -876,8 +1338,20 @@ bool SelectionTool::InitiateDatabase(const ArgumentParser& parser)
 // Main method. Combines selecting and displaying.
 void SelectionTool::SelectAndDisplay()
 {
+  // LFNs are printed directly
+  if(listing_only)
+  {
+    size_t N_lfn = ListingLFN();
+    if(N_listed)
+      ReportMissingLFN();
+    cerr << N_lfn << (N_lfn>1?" LFNs":" LFN") << " listed." << endl;
+    return;
+  }
+
   // Asking for records.
   size_t N_records = FetchingRecords();
+  if(N_listed)
+    ReportMissingLFN();
   if(0 == N_records)
   {
     cout << "No records detected..." << endl;
@@ -907,25 +1381,96 @@ void SelectionTool::SelectAndDisplay()
 size_t SelectionTool::FetchingRecords()
 {
   // "command" has been verified
-  vector<vector<string> > data;
 //cout << "command: |" << command << "|." << endl;
-  if(!GetDataFromDB(command, data))
+  // Records are inserted into holder one by one as they arrive
+  Collecting collector(holder);
+  if(!StreamDataFromDB(command, collector))
   {
     cout << "Error getting records..." << endl;
     return 0;
   }
+  // Release the result so that the connection is ready for next query
+  ClearData();
 
   // Number of records
-  size_t NNN = data.size();
-  for(size_t i=0;i<NNN;++i)
+  return GetNRows();
+}
+
+// List LFNs directly from database
+size_t SelectionTool::ListingLFN()
+{
+  ofstream out;
+  if(!output.empty())
+  {
+    out.open(output.c_str());
+    if(!out.is_open())
+    {
+      cerr << "Can't open a \"" << output << "\" for redirecting output..." << endl;
+      return 0;
+    }
+  }
+
+  ostream screen(standard_output ? standard_output : cout.rdbuf());
+  Listing printer(output.empty() || !surpressing ? &screen : 0, out.is_open() ? &out : 0);
+  if(!StreamDataFromDB(command, printer))
   {
-    vector<string>& one_set = data[i];
-    // Transform the record by replacing NULL with a string "NULL".
-    for_each(one_set.begin(), one_set.end(), Replacing());
-    // Insert the transformed record.
-    holder.Insert(one_set);
+    cout << "Error getting records..." << endl;
+    return 0;
   }
+  ClearData();
+  screen.flush();
 
-  return NNN;
+  return GetNRows();
 }
 
+// Create the temporary table and insert all LFNs into it
+// Need 1 argument:
+//   1. LFNs (no repetition)
+bool SelectionTool::LoadLFNList(const vector<string>& lfn_list)
+{
+  if(!CreateTemporaryTable(lfn_list_table, "(wanted_lfn varchar(1024) not null)"))
+    return false;
+
+  vector<string> tuples;
+  tuples.reserve(lfn_list.size());
+  for(vector<string>::const_iterator it = lfn_list.begin(); it != lfn_list.end(); ++it)
+    tuples.push_back("('" + Escape(*it) + "')");
+
+  if(!BatchInsert("insert into " + lfn_list_table + " (wanted_lfn) values ", tuples))
+    return false;
+
+  N_listed = tuples.size();
+  cout << N_listed << " LFN(s) loaded for lookup." << endl;
+  return true;
+}
+
+// LFNs in the list but not in the catalog (other conditions omitted)
+void SelectionTool::ReportMissingLFN()
+{
+  string missing_command("select wanted_lfn from ");
+  missing_command.append(lfn_list_table);
+  missing_command.append(" left join ");
+  missing_command.append(table);
+  missing_command.append(" on lfn = wanted_lfn where lfn is NULL");
+
+  vector<vector<string> > data;
+  if(!GetDataFromDB(missing_command, data))
+  {
+    cerr << "Error looking for missing LFN(s)..." << endl;
+    return;
+  }
+  ClearData();
+
+  if(data.empty())
+  {
+    cout << "All " << N_listed << " LFN(s) found in " << table << "." << endl;
+    return;
+  }
+  cerr << "\033[33m" << data.size() << " of " << N_listed << " LFN(s) not found in " << table << ":\033[0m" << endl;
+  for(size_t i=0;i<data.size();++i)
+    cerr << "  " << data[i][0] << endl;
+}
+
+// Definition of static const
+const string SelectionTool::lfn_list_table = "tmp_lfn_list";
+
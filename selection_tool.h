@@ -6,6 +6,37 @@
 
 #include <stdexcept>
 #include <map>
+// Node of the expression tree of conditions. A node is either a leaf (a piece
+// of MySQL condition), or a group of nodes joined by logical AND/OR.
+class ConditionNode {
+public:
+  enum NodeType {
+    Leaf,
+    AndGroup,
+    OrGroup,
+  };
+private:
+  // One of NodeType
+  int type;
+  // MySQL condition (leaf only)
+  std::string expression;
+  // Members of a group
+  std::vector<ConditionNode> children;
+public:
+  // Constructor. A leaf needs its <leaf_expression>
+  explicit ConditionNode(int node_type = AndGroup, const std::string& leaf_expression = "");
+
+  // Add a node into this group. Empty nodes are omitted, and a group of the
+  // same type is flattened.
+  void Add(const ConditionNode& child);
+
+  // Returns true if there is no condition in this node
+  bool Empty() const;
+
+  // Convert to MySQL condition (parentheses added where necessary)
+  std::string Output() const;
+};
+
 // Structure measuring a range of a column
 class Conditions {
 public:
@@ -52,6 +83,18 @@ public:
   std::string Title() const { return title; }
   std::string LowEdge() const { return low_edge; }
   std::string HighEdge() const { return high_edge; }
+  bool LowUnlimited() const { return unlimited == low_edge; }
+  bool HighUnlimited() const { return unlimited == high_edge; }
+  // A single value rather than a range
+  bool SingleValue() const { return low_edge == high_edge; }
+
+  // Compare two edges: as numbers with <numeric> (as the server casts a
+  // string: by its leading number, 0 if none), or as strings otherwise.
+  // Returns negative if <a> is lower, 0 if equal, positive otherwise.
+  static int CompareEdges(const std::string& a, const std::string& b, bool numeric);
+  // Whether both edges are numbers: how the edges of a condition are ordered
+  // before its column is known
+  static bool NumericEdges(const std::string& a, const std::string& b);
 
   // Factory: condition generator
   // Exception class
@@ -65,11 +108,13 @@ public:
     WithCommentsOnly,
     UnlimitedComments,
   };
-  static void CommentConditions(int comment_status, std::string& command);
+  static ConditionNode CommentConditions(int comment_status);
 
 private:
   void Convert(double v, std::string& s);
   inline void AddQuote(const std::string& source, std::string& s);
+  // ColumnRanges merges edges directly
+  friend class ColumnRanges;
 public:
   class MapInitiater;
   friend class MapInitiater;
@@ -89,6 +134,34 @@ private:
   std::string GetTimeNow() const;
 };
 
+// All conditions on one column joined by logical OR. Overlapping ranges are
+// merged, and single values are collected into an "in" list, so that MySQL
+// could answer them with a few range scans on the index of this column.
+// All edges are compared the same way, by the type of the column.
+class ColumnRanges {
+  // Name of this column
+  std::string title;
+  // Whether the column is numeric (see BaseParser::NumericColumn)
+  bool numeric;
+  // Ranges (two different edges)
+  std::vector<Conditions> ranges;
+  // Single values
+  std::vector<std::string> values;
+public:
+  ColumnRanges(const std::string& name, bool numeric_column);
+
+  const std::string& Title() const { return title; }
+
+  // Take in a condition on this column. Returns false if on another column.
+  bool Add(const Conditions& one_condition);
+
+  // Merge overlapping ranges, and remove values covered by them.
+  void Merge();
+
+  // Convert to a node of conditions (Merge is called first).
+  ConditionNode Output();
+};
+
 
 #include "common_tools.h"
 class ArgumentParser: public BaseParser {
@@ -105,7 +178,23 @@ class ArgumentParser: public BaseParser {
   // Comment status
   int comment_status;
   // Selecting rules for filename
-  std::string file_hints;
+  ConditionNode file_hints;
+  // LFNs wanted exactly (from "--lfn-list"), no repetition
+  std::vector<std::string> lfn_list;
+  // Aggregation on the server: only summaries are transferred
+  // Whether to count the files
+  bool counting;
+  // Columns to sum up
+  std::vector<std::string> sum_columns;
+  // Columns to group the records by
+  std::vector<std::string> group_columns;
+  // Columns to select exactly (from "--columns"; print level omitted)
+  std::vector<std::string> projected_columns;
+  // Only LFNs are selected, and printed as a plain list
+  bool lfn_only;
+  // The standard output, kept for the list of LFNs (other messages of cout
+  // are then sent to cerr)
+  std::streambuf* standard_output;
 public:
   // Default constructor
   ArgumentParser();
@@ -123,6 +212,19 @@ public:
   std::string Output() const { return output_file; }
   int PrintLevel() const { return print_level; }
   bool Surpressing() const { return surpressing; }
+  const std::vector<std::string>& LFNList() const { return lfn_list; }
+  bool Projecting() const { return !projected_columns.empty(); }
+  bool LFNOnly() const { return lfn_only; }
+  std::streambuf* StandardOutput() const { return standard_output; }
+
+  // Returns true if summaries (count/sum) rather than records are wanted
+  bool Aggregating() const
+  { return counting || !sum_columns.empty() || !group_columns.empty(); }
+  // Names of columns of the summaries
+  void AggregationNames(std::vector<std::string>& target) const;
+  // Items after "select", and items after "group by" (empty if no grouping)
+  std::string AggregationColumns() const;
+  std::string GroupingColumns() const;
   Conditions GetOneCondition(size_t location) const
   { return location < N_conditions() ? conditions[location] : Conditions::Factory("UNDEFINED"); }
 
@@ -135,7 +237,8 @@ public:
   // Need two arguments:
   //   1. Target container of names
   //   2. Printing levels.
-  //      -2:	Use print_level from ArgumentParser
+  //      -2:	Use print_level from ArgumentParser (or columns from
+  //      		"--columns" if any)
   //      -1:	Take all columns
   //      0-3:	Use this level
   //      Others:	returns with an empty <target>
@@ -144,7 +247,9 @@ public:
   std::string ColumnNames(int level = -2) const;
 private:
   bool SetOutputFile(const std::string& filename, bool surpress);
-  void AddFileHint(std::string& command) const;
+  void AddFileHints(std::vector<std::string>& filename);
+  bool ReadLFNList(const std::string& filename);
+  bool RealColumns(const std::string& hint, std::vector<std::string>& target) const;
 };
 
 class SelectionTool: MySQLInterface {
@@ -168,6 +273,19 @@ class SelectionTool: MySQLInterface {
   std::string output;
   // Whether to surpress standard output in case of file savings
   bool surpressing;
+  // Name of table queried
+  std::string table;
+  // Number of LFNs loaded into the temporary table (0 if not used)
+  size_t N_listed;
+  // Whether summaries rather than records are selected
+  bool aggregating;
+  // Whether LFNs only are selected and listed
+  bool listing_only;
+  // Where the list of LFNs is printed (stdout)
+  std::streambuf* standard_output;
+
+  // Temporary table holding LFNs from "--lfn-list"
+  static const std::string lfn_list_table;
 public:
   // Constructor.
   SelectionTool();
@@ -186,6 +304,16 @@ private:
   // Returns the number of records fetched.
   size_t FetchingRecords();
 
+  // Load the LFNs to look up into the temporary table
+  bool LoadLFNList(const std::vector<std::string>& lfn_list);
+
+  // Print LFNs in the temporary table that are not in the catalog
+  void ReportMissingLFN();
+
+  // Fetch LFNs and print them one per line as they arrive (no buffer)
+  // Returns the number of LFNs
+  size_t ListingLFN();
+
   // Print all record(s) fetched.
   // Called after FetchingRecords
   void Print(std::ostream& outflow) const